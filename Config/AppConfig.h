@@ -56,33 +56,46 @@
 #define START_BOOTLOADER_REPORT_ID 0xff
 
 #define TIMESTAMP_OFFSET_FR_ID 1
+// ms without the host taking an IN report before queued events are held for a resync
+#define HOST_LINK_TIMEOUT 2000
 
+// report lengths and layouts come from the schema in reports.h
 #define MSG_STATUS_ID 1
-#define MSG_STATUS_SIZE (8+4)
-
 #define MSG_CONFIG_ID 1
-#define MSG_CONFIG_SIZE_POKEY (4+2+10*1)
-#define MSG_CONFIG_SIZE_PEGGY (4+2)
-
 #define MSG_WALL_ERROR_ID 12
-#define MSG_WALL_ERROR_SIZE (8+4)
-
 #define MSG_DROP_ERROR_ID 13
-#define MSG_DROP_ERROR_SIZE 8
-
 #define MSG_POKE_ID 14
-#define MSG_POKE_SIZE (8+1)
+#define MSG_TOOL_ID 16
+#define MSG_EVENT_ID 17
+#define MSG_PEG_SNAPSHOT_ID 18
 
-#define MSG_PEG_ID 15
-#define MSG_PEG_SIZE (8+1+1)
+#define BOX_TYPE_ID 0x45
+#define RAW_VALUES_ID 0x45
+#define HARDWARE_FAULT_ID 70
+#define PEG_THRESHOLDS_ID 71
 
-#define MSG_TOOL_ID 16
-#define MSG_TOOL_SIZE (8+1)
+#define SERIAL_NUMBER_ID 73
+#define SERIAL_NUMBER_MAX_LEN 16
 
-#define MSG_EVENT_ID 17
-#define MSG_EVENT_SIZE (8+1)
+#define SESSION_LOG_ID 72
+#define SESSION_LOG_PAGE_RECORDS 3
+
+#define REPORT_LATENCY_ID 74
+
+#define CONTACT_METRICS_ID 75
+
+#define TOOL_THRESHOLDS_ID 76
+
+#define PEG_DRIFT_ID 77
+
+#define PEG_CALIBRATION_ID 78
 
-//TODO make a single file that describes every region of the eeprom in use
+// eeprom map: the settings store ring (settings.c) from the bottom, the session log (session_log.c) above it
+#define SETTINGS_EEP_START 0
+#define SETTINGS_SLOT_SIZE 64
+#define SETTINGS_SLOTS 4
+#define SESSION_LOG_EEP_START 256
+#define SESSION_LOG_EEP_END (E2END + 1)
 
 	#define DEVICE_NAME_REPORT_ID 2
 	#define DEVICE_NAME_REPORT_SIZE 255
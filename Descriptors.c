@@ -39,6 +39,9 @@
 #include "Timer.h"
 #include "led.h"
 #include "box.h"
+#include "session_log.h"
+#include "settings.h"
+#include "reports.h"
 
 #define USAGE(id) HID_RI_USAGE(8, id)
 #define STRING_INDEX(i) HID_RI_STRING(8, i)
@@ -48,237 +51,53 @@
 #define REPORT_COUNT(c) HID_RI_REPORT_COUNT(8, c)
 #define REPORT_SIZE(s) HID_RI_REPORT_SIZE(8, s)
 
+#define ITEM_UINT SIMPLE_HID_UINT
+#define ITEM_UINTS SIMPLE_HID_UINT
+#define ITEM_INT SIMPLE_HID_INT
+#define ITEM_INTS SIMPLE_HID_INT
+#define ITEM_UTF8 SIMPLE_HID_UTF8
+#define DATA_In HID_RI_INPUT(8, HID_IOF_VARIABLE)
+#define DATA_Out HID_RI_OUTPUT(8, HID_IOF_VARIABLE)
+#define DATA_Feature HID_RI_FEATURE(8, HID_IOF_VARIABLE)
+#define NODATA_In HID_RI_INPUT(0)
+#define NODATA_Out HID_RI_OUTPUT(0)
+#define NODATA_Feature HID_RI_FEATURE(0)
+
+#define FIELD_ITEMS_UINT(dir, bits, count) USAGE(ITEM_UINT), REPORT_SIZE(bits), REPORT_COUNT(count), DATA_##dir,
+#define FIELD_ITEMS_UINTS(dir, bits, count) USAGE(ITEM_UINTS), REPORT_SIZE(bits), REPORT_COUNT(count), DATA_##dir,
+#define FIELD_ITEMS_INT(dir, bits, count) USAGE(ITEM_INT), REPORT_SIZE(bits), REPORT_COUNT(count), DATA_##dir,
+#define FIELD_ITEMS_INTS(dir, bits, count) USAGE(ITEM_INTS), REPORT_SIZE(bits), REPORT_COUNT(count), DATA_##dir,
+#define FIELD_ITEMS_UTF8(dir, bits, count) USAGE(ITEM_UTF8), REPORT_SIZE(bits), REPORT_COUNT(count), DATA_##dir,
+#define FIELD_ITEMS_EMPTY(dir, bits, count) REPORT_SIZE(0), REPORT_COUNT(1), NODATA_##dir,
+/* object members carry their name, array members are anonymous */
+#define AS_OBJECT_ITEM(box, dir, name, type, bits, count, boxes) \
+	ON_##box##_##boxes(STRING_INDEX(STRING_ID_##name), FIELD_ITEMS_##type(dir, bits, count))
+#define AS_ARRAY_ITEM(box, dir, name, type, bits, count, boxes) \
+	ON_##box##_##boxes(FIELD_ITEMS_##type(dir, bits, count))
+#define AS_REPORT_ITEMS(box, name, id, dir, kind, boxes) ON_##box##_##boxes( \
+		STRING_INDEX(STRING_ID_##name), \
+		REPORT_ID(id), \
+		USAGE(SIMPLE_HID_##kind), \
+		REPORT_COLLECTION, \
+			REPORT_FIELDS_##name(AS_##kind##_ITEM, box, dir) \
+		END_COLLECTION, \
+	)
+
 /** HID class report descriptor. This is a special descriptor constructed with values from the
  *  USBIF HID class specification to describe the reports and capabilities of the HID device. This
  *  descriptor is parsed by the host and its contents used to determine what data (and in what encoding)
  *  the device will send, and what it may be sent back from the host. Refer to the HID specification for
  *  more details on HID report descriptors.
+ *
+ *  Both boxes' descriptors are generated from the report schema in reports.h, which also generates the code that
+ *  fills and reads the reports, so the two cannot drift apart.
  */
 const USB_Descriptor_HIDReport_Datatype_t PROGMEM HID_Descriptor_Pokey[] =
 {
-		HID_RI_USAGE_PAGE(16, SIMPLE_HID_USAGE_PAGE),
-		HID_RI_USAGE(0, SIMPLE_HID_APPLICATION_COLLECTION), /* Can be size 0 because value is 0 */
-		HID_RI_COLLECTION(8, 0x01), /* Application Collection */
-
-		/* Report Name: 'config'
-		 * Report ID:   1
-		 * Report Type: Feature
-		 * Report Data: { 'timeout': Uint32,
-		 *                'error_threshold': Uint16,
-		 *                'item_order': Uint8[10] }
-		 */
-		STRING_INDEX(STRING_ID_config),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timeout),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(32), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_error_threshold),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_item_order),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(10), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'timestamp'
-		 * Report ID:   1
-		 * Report Type: Output
-		 * Report Data: [ Uint64 ]
-		 */
-		STRING_INDEX(STRING_ID_timestamp),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_ARRAY), /* Technically redundant because Array is default */
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_OUTPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'status'
-		 * Report ID:   1
-		 * Report Type: Input
-		 * Report Data: { 'timestamp': Uint64,
-		 *                'status': Uint8[4] }
-		 */
-		STRING_INDEX(STRING_ID_status),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_status),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(4), REPORT_COUNT(4), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'wall_error'
-		 * Report ID:   12
-		 * Report Type: Input
-		 * Report Data: { 'timestamp': Uint64,
-		 *                'duration': Uint32 }
-		 */
-		STRING_INDEX(STRING_ID_wall_error),
-		REPORT_ID(12),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_duration),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(32), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: drop_error
-		 * Report ID:   13
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64 }
-		 */
-		STRING_INDEX(STRING_ID_drop_error),
-		REPORT_ID(13),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: poke
-		 * Report ID:   14
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                location: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_poke),
-		REPORT_ID(14),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_location),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: peg
-		 * Report ID:   15
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                location: Uint8,
-		 *                new_state: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_peg),
-		REPORT_ID(15),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_location),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_new_state),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: tool
-		 * Report ID:   16
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                new_state: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_tool),
-		REPORT_ID(16),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_new_state),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Debug Reports */
-		/* Report Name: event
-		 * Report ID:   17
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                event_number: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_event),
-		REPORT_ID(17),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_event_number),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: box_type
-		 * Report ID:   0x45
-		 * Report Type: Feature
-		 * Report Data: { box_type: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_box_type),
-		REPORT_ID(0x45),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_box_type),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: toggle_raw
-		 * Report ID:   0x45
-		 * Report Type: Output
-		 * Report Data: None
-		 */
-		REPORT_ID(0x45),
-		STRING_INDEX(STRING_ID_toggle_raw),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			REPORT_SIZE(0), REPORT_COUNT(1), HID_RI_OUTPUT(0),
-		END_COLLECTION,
-
-		/* Report Name: raw_values
-		 * Report ID:   0x45
-		 * Report Type: Input
-		 * Report Data: [ ...Uint16[10], ...Uint8[10] ]
-		 */
-		STRING_INDEX(STRING_ID_raw_values),
-		REPORT_ID(0x45),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(10), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(10), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: hardware_fault
-		 * Report ID:   70
-		 * Report Type: Feature
-		 * Report Data: [ Uint64 ]
-		 */
-		STRING_INDEX(STRING_ID_hardware_fault),
-		REPORT_ID(70),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: peg_thresholds
-		 * Report ID:   71
-		 * Report Type: Feature
-		 * Report Data: [ ...Uint16[6] ]
-		 */
-		STRING_INDEX(STRING_ID_peg_thresholds),
-		REPORT_ID(71),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(6), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Set Feature to this report triggers bootloader */
-		/* Report Name: bootloader
-		 * Report ID:   0xFF
-		 * Report Type: Feature (Set only)
-		 * Report Data: None
-		 */
-		STRING_INDEX(STRING_ID_bootloader),
-		REPORT_ID(START_BOOTLOADER_REPORT_ID),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			REPORT_SIZE(0), REPORT_COUNT(1), HID_RI_FEATURE(0),
-		END_COLLECTION,
-
+	HID_RI_USAGE_PAGE(16, SIMPLE_HID_USAGE_PAGE),
+	HID_RI_USAGE(0, SIMPLE_HID_APPLICATION_COLLECTION), /* Can be size 0 because value is 0 */
+	HID_RI_COLLECTION(8, 0x01), /* Application Collection */
+		REPORTS(AS_REPORT_ITEMS, POKEY)
 	HID_RI_END_COLLECTION(0),
 };
 
@@ -287,223 +106,7 @@ const USB_Descriptor_HIDReport_Datatype_t PROGMEM HID_Descriptor_Peggy[] =
 	HID_RI_USAGE_PAGE(16, SIMPLE_HID_USAGE_PAGE),
 	HID_RI_USAGE(0, SIMPLE_HID_APPLICATION_COLLECTION), /* Can be size 0 because value is 0 */
 	HID_RI_COLLECTION(8, 0x01), /* Application Collection */
-
-		/* Report Name: 'config'
-		 * Report ID:   1
-		 * Report Type: Feature
-		 * Report Data: { 'timeout': Uint32,
-		 *                'error_threshold': Uint16 }
-		 */
-		STRING_INDEX(STRING_ID_config),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timeout),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(32), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_error_threshold),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'timestamp'
-		 * Report ID:   1
-		 * Report Type: Output
-		 * Report Data: [ Uint64 ]
-		 */
-		STRING_INDEX(STRING_ID_timestamp),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_ARRAY), /* Technically redundant because Array is default */
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_OUTPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'status'
-		 * Report ID:   1
-		 * Report Type: Input
-		 * Report Data: { 'timestamp': Uint64,
-		 *                'status': Uint8[4] }
-		 */
-		STRING_INDEX(STRING_ID_status),
-		REPORT_ID(1),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_status),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(4), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: 'wall_error'
-		 * Report ID:   12
-		 * Report Type: Input
-		 * Report Data: { 'timestamp': Uint64,
-		 *                'duration': Uint32 }
-		 */
-		STRING_INDEX(STRING_ID_wall_error),
-		REPORT_ID(12),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_duration),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(32), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-	    /* Report Name: drop_error
-		 * Report ID:   13
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64 }
-		 */
-		STRING_INDEX(STRING_ID_drop_error),
-		REPORT_ID(13),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: poke
-		 * Report ID:   14
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                location: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_poke),
-		REPORT_ID(14),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_location),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: peg
-		 * Report ID:   15
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                location: Uint8,
-		 *                new_state: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_peg),
-		REPORT_ID(15),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_location),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_new_state),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: tool
-		 * Report ID:   16
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                new_state: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_tool),
-		REPORT_ID(16),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_new_state),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Debug Reports */
-		/* Report Name: event
-		 * Report ID:   17
-		 * Report Type: Input
-		 * Report Data: { timestamp: Uint64,
-		 *                event_number: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_event),
-		REPORT_ID(17),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_timestamp),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			STRING_INDEX(STRING_ID_event_number),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: box_type
-		 * Report ID:   0x45
-		 * Report Type: Feature
-		 * Report Data: { box_type: Uint8 }
-		 */
-		STRING_INDEX(STRING_ID_box_type),
-		REPORT_ID(0x45),
-		USAGE(SIMPLE_HID_OBJECT),
-		REPORT_COLLECTION,
-			STRING_INDEX(STRING_ID_box_type),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: toggle_raw
-		 * Report ID:   0x45
-		 * Report Type: Output
-		 * Report Data: None
-		 */
-		REPORT_ID(0x45),
-		STRING_INDEX(STRING_ID_toggle_raw),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			REPORT_SIZE(0), REPORT_COUNT(1), HID_RI_OUTPUT(0),
-		END_COLLECTION,
-
-		/* Report Name: raw_values
-		 * Report ID:   0x45
-		 * Report Type: Input
-		 * Report Data: [ ...Uint16[10], ...Uint8[10] ]
-		 */
-		STRING_INDEX(STRING_ID_raw_values),
-		REPORT_ID(0x45),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(10), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(8), REPORT_COUNT(10), HID_RI_INPUT(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: hardware_fault
-		 * Report ID:   70
-		 * Report Type: Feature
-		 * Report Data: [ Uint64 ]
-		 */
-		STRING_INDEX(STRING_ID_hardware_fault),
-		REPORT_ID(70),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(64), REPORT_COUNT(1), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Report Name: peg_thresholds
-		 * Report ID:   71
-		 * Report Type: Feature
-		 * Report Data: [ ...Uint16[6] ]
-		 */
-		STRING_INDEX(STRING_ID_peg_thresholds),
-		REPORT_ID(71),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			USAGE(SIMPLE_HID_UINT), REPORT_SIZE(16), REPORT_COUNT(6), HID_RI_FEATURE(8, HID_IOF_VARIABLE),
-		END_COLLECTION,
-
-		/* Set Feature to this report triggers bootloader */
-		/* Report Name: bootloader
-		 * Report ID:   0xFF
-		 * Report Type: Feature (Set only)
-		 * Report Data: None
-		 */
-		STRING_INDEX(STRING_ID_bootloader),
-		REPORT_ID(START_BOOTLOADER_REPORT_ID),
-		USAGE(SIMPLE_HID_ARRAY),
-		REPORT_COLLECTION,
-			REPORT_SIZE(0), REPORT_COUNT(1), HID_RI_FEATURE(0),
-		END_COLLECTION,
-
+		REPORTS(AS_REPORT_ITEMS, PEGGY)
 	HID_RI_END_COLLECTION(0),
 };
 
@@ -669,37 +272,61 @@ const USB_Descriptor_String_t PROGMEM ManufacturerString = USB_STRING_DESCRIPTOR
  */
 const USB_Descriptor_String_t PROGMEM ProductString = USB_STRING_DESCRIPTOR(L"Orthobox");
 
-//TODO change this to directly inject bytes
-const USB_Descriptor_String_t PROGMEM SerialNumber = USB_STRING_DESCRIPTOR(L"Demo");
+/** Serial number descriptor string. This is built in RAM at startup from the serial stored in the settings, so that
+ *  every box enumerates with its own serial. Boxes that have not been provisioned report "Demo".
+ */
+struct
+{
+	USB_Descriptor_Header_t Header;
+	uint16_t UnicodeString[SERIAL_NUMBER_MAX_LEN];
+} SerialNumber;
+
+void serial_number_init(void)
+{
+	const char* str = settings.serial[0] ? settings.serial : "Demo";
+	uint8_t len = 0;
+
+	while (len < SERIAL_NUMBER_MAX_LEN && str[len]) {
+		SerialNumber.UnicodeString[len] = str[len];
+		len++;
+	}
+	SerialNumber.Header.Size = USB_STRING_LEN(len);
+	SerialNumber.Header.Type = DTYPE_String;
+}
+
+/** Stores a serial number if none has been provisioned yet. Only printable ASCII is accepted; the string ends at the
+ *  first NUL or at the end of the report. The new serial is used from the next enumeration.
+ */
+bool set_serial_number(const uint8_t* str, uint16_t len)
+{
+	uint8_t i;
+
+	if (settings.serial[0])
+		return false;
+	for (i = 0; i < len && i < SERIAL_NUMBER_MAX_LEN && str[i]; i++) {
+		if (str[i] < 0x21 || str[i] > 0x7e)
+			return false;
+	}
+	if (!i)
+		return false;
+
+	memset(settings.serial, 0, SERIAL_NUMBER_MAX_LEN);
+	memcpy(settings.serial, str, i);
+	settings_save();
+	serial_number_init();
+	return true;
+}
 
 #define LSTR(str) L ## str
-#define N_VAR(var) const USB_Descriptor_String_t PROGMEM NAMED_##var = USB_STRING_DESCRIPTOR(LSTR(#var))
-
-N_VAR(timestamp);
-N_VAR(status);
-N_VAR(config);
-N_VAR(timeout);
-N_VAR(error_threshold);
-N_VAR(item_order);
-N_VAR(wall_error);
-N_VAR(duration);
-N_VAR(drop_error);
-N_VAR(poke);
-N_VAR(location);
-N_VAR(peg);
-N_VAR(new_state);
-N_VAR(tool);
-N_VAR(event);
-N_VAR(event_number);
-N_VAR(box_type);
-N_VAR(toggle_raw);
-N_VAR(raw_values);
-N_VAR(hardware_fault);
-N_VAR(peg_thresholds);
-N_VAR(bootloader);
-
-// TODO: Populate remaining string descriptors.
-#define N_CASE(var) case STRING_ID_##var: Address = &NAMED_##var; Size = pgm_read_byte(&NAMED_##var.Header.Size); break;
+#define N_VAR(var) const USB_Descriptor_String_t PROGMEM NAMED_##var = USB_STRING_DESCRIPTOR(LSTR(#var));
+#define N_PTR(var) &NAMED_##var,
+
+NAMED_STRINGS(N_VAR)
+
+/** Named string descriptors indexed by string ID, starting from the ID after the serial number. */
+const USB_Descriptor_String_t* const PROGMEM NamedStrings[] = {NAMED_STRINGS(N_PTR)};
+
+_Static_assert(STRING_ID_Named_End <= 0x100, "string descriptor IDs must fit in a byte");
 
 /** This function is called by the library when in device mode, and must be overridden (see library "USB Descriptors"
  *  documentation) by the application code so that the address and size of a requested descriptor can be given
@@ -709,13 +336,15 @@ N_VAR(bootloader);
  */
 uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
                                     const uint16_t wIndex,
-                                    const void** const DescriptorAddress)
+                                    const void** const DescriptorAddress,
+                                    uint8_t* const DescriptorMemorySpace)
 {
 	const uint8_t  DescriptorType   = (wValue >> 8);
 	const uint8_t  DescriptorNumber = (wValue & 0xFF);
 
 	const void* Address = NULL;
 	uint16_t    Size    = NO_DESCRIPTOR;
+	uint8_t     MemorySpace = MEMSPACE_FLASH;
 	UNUSED(wIndex);
 	switch (DescriptorType)
 	{
@@ -752,30 +381,14 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 					break;
 				case STRING_ID_Serial_Number:
 					Address = &SerialNumber;
-					Size    = pgm_read_byte(&SerialNumber.Header.Size);
+					Size    = SerialNumber.Header.Size;
+					MemorySpace = MEMSPACE_RAM;
 					break;
-				N_CASE(timestamp);
-				N_CASE(status);
-				N_CASE(config);
-				N_CASE(timeout);
-				N_CASE(error_threshold);
-				N_CASE(item_order);
-				N_CASE(wall_error);
-				N_CASE(duration);
-				N_CASE(drop_error);
-				N_CASE(poke);
-				N_CASE(location);
-				N_CASE(peg);
-				N_CASE(new_state);
-				N_CASE(tool);
-				N_CASE(event);
-				N_CASE(event_number);
-				N_CASE(box_type);
-				N_CASE(toggle_raw);
-				N_CASE(raw_values);
-				N_CASE(hardware_fault);
-				N_CASE(peg_thresholds);
-				N_CASE(bootloader);
+				default:
+					if (DescriptorNumber < STRING_ID_Named_End) {
+						Address = pgm_read_ptr(&NamedStrings[DescriptorNumber - (STRING_ID_Serial_Number + 1)]);
+						Size    = pgm_read_byte(&((const USB_Descriptor_String_t*)Address)->Header.Size);
+					}
 			}
 
 			break;
@@ -801,6 +414,7 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 	}
 
 	*DescriptorAddress = Address;
+	*DescriptorMemorySpace = MemorySpace;
 	return Size;
 }
 
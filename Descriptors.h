@@ -85,6 +85,57 @@
 			INTERFACE_ID_GenericHID = 0, /**< GenericHID interface descriptor ID */
 		};
 
+		/** List of the names used by the SimpleHID report descriptors. Each entry gets a string descriptor ID, a string
+		 *  descriptor holding the name, and an entry in the lookup table in Descriptors.c, in this order. Adding a name
+		 *  here is all that is needed before using STRING_ID_<name> in a report descriptor.
+		 */
+		#define NAMED_STRINGS(_) \
+			_(timestamp) \
+			_(status) \
+			_(config) \
+			_(timeout) \
+			_(error_threshold) \
+			_(merge_window) \
+			_(item_order) \
+			_(wall_error) \
+			_(duration) \
+			_(contacts) \
+			_(peak_gap) \
+			_(drop_error) \
+			_(poke) \
+			_(location) \
+			_(peg_snapshot) \
+			_(state) \
+			_(changed) \
+			_(deltas) \
+			_(new_state) \
+			_(tool) \
+			_(event) \
+			_(event_number) \
+			_(box_type) \
+			_(toggle_raw) \
+			_(raw_values) \
+			_(hardware_fault) \
+			_(peg_thresholds) \
+			_(session_log) \
+			_(count) \
+			_(page) \
+			_(records) \
+			_(session_log_page) \
+			_(serial_number) \
+			_(report_latency) \
+			_(histogram) \
+			_(worst) \
+			_(contact_metrics) \
+			_(total) \
+			_(longest) \
+			_(tool_thresholds) \
+			_(peg_drift) \
+			_(peg_calibration) \
+			_(bootloader)
+
+		#define AS_STRING_ID(var) STRING_ID_##var,
+
 		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
 		 *  have a unique ID index associated with it, which can be used to refer to the string from
 		 *  other descriptors.
@@ -95,28 +146,8 @@
 			STRING_ID_Manufacturer      = 1, /**< Manufacturer string ID */
 			STRING_ID_Product           = 2, /**< Product string ID */
 			STRING_ID_Serial_Number     = 3,
-			STRING_ID_timestamp         = 4,
-			STRING_ID_status            = 5,
-			STRING_ID_config            = 6,
-			STRING_ID_timeout           = 7,
-			STRING_ID_error_threshold   = 8,
-			STRING_ID_item_order        = 9,
-			STRING_ID_wall_error        = 10,
-			STRING_ID_duration          = 11,
-			STRING_ID_drop_error        = 12,
-			STRING_ID_poke              = 13,
-			STRING_ID_location          = 14,
-			STRING_ID_peg               = 15,
-			STRING_ID_new_state         = 16,
-			STRING_ID_tool              = 17,
-			STRING_ID_event             = 18,
-			STRING_ID_event_number      = 19,
-			STRING_ID_box_type          = 20,
-			STRING_ID_toggle_raw        = 21,
-			STRING_ID_raw_values        = 22,
-			STRING_ID_hardware_fault    = 23,
-			STRING_ID_peg_thresholds    = 24,
-			STRING_ID_bootloader        = 255,
+			NAMED_STRINGS(AS_STRING_ID)
+			STRING_ID_Named_End, /**< One past the last named string ID */
 		};
 
 		enum {
@@ -132,8 +163,12 @@
 	/* Function Prototypes: */
 		uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 		                                    const uint16_t wIndex,
-		                                    const void** const DescriptorAddress)
-		                                    ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(3);
+		                                    const void** const DescriptorAddress,
+		                                    uint8_t* const DescriptorMemorySpace)
+		                                    ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(3) ATTR_NON_NULL_PTR_ARG(4);
+
+		void serial_number_init(void);
+		bool set_serial_number(const uint8_t* str, uint16_t len);
 
 #endif
 
@@ -39,9 +39,6 @@
 #include "Descriptors.h"
 #include "MS_OS_20_Device.h"
 
-/** Buffer to hold the previously generated HID report, for comparison purposes inside the HID class driver. */
-static uint8_t PrevHIDReportBuffer[255]; 
-
 /** LUFA HID Class driver interface configuration and state information. This structure is
  *  passed to all HID Class driver functions, so that multiple instances of the same class
  *  within a device can be differentiated from one another.
@@ -57,8 +54,10 @@ USB_ClassInfo_HID_Device_t Generic_HID_Interface =
 						.Size                 = GENERIC_EPSIZE,
 						.Banks                = 1,
 					},
-				.PrevReportINBuffer           = PrevHIDReportBuffer,
-				.PrevReportINBufferSize       = sizeof(PrevHIDReportBuffer),
+				/* No previous report buffer: every report we create is meant to be sent, so LUFA's duplicate
+				 * suppression only cost RAM. The size is still used for the driver's report buffers on the stack. */
+				.PrevReportINBuffer           = NULL,
+				.PrevReportINBufferSize       = REPORT_MAX_SIZE,
 			},
 	};
 
@@ -94,9 +93,27 @@ void Jump_To_Bootloader(void)
 
 /* end bootloader stuff*/
 
-uint8_t send_raw;
-uint8_t send_status;
-uint8_t status_sent;
+/* Events are held until the host has given us a clock, and again whenever the link drops, so that they go out with a
+ * correct host timestamp. A timestamp received while the link is down resyncs instead of restarting the task. */
+uint8_t time_synced;
+uint8_t link_lost;
+ms_time_t last_in_poll;
+
+static void link_down(void)
+{
+	if (time_synced)
+		link_lost = 1;
+	time_synced = 0;
+}
+
+static int task_in_progress(void)
+{
+	if (box_type == BOX_TYPE_PEGGY)
+		return peggy_task_running();
+	if (box_type == BOX_TYPE_POKEY)
+		return pokey_task_running();
+	return 0;
+}
 
 #define VALUE_TO_STRING(x) #x
 #define VALUE(x) VALUE_TO_STRING(x)
@@ -107,12 +124,14 @@ uint8_t status_sent;
 int main(void)
 {
 	SetupHardware();
-	LEDs_SetAllLEDs(LEDMASK_USB_NOTREADY);
 	GlobalInterruptEnable();
-	buzzer_init();
+	sound_init();
 	timer_init();
+	led_init();
 	box_init();
-	adc_task();
+	adc_sweep();
+	settings_load();
+	serial_number_init();
 
 	//Serial_Init(115200, 0);
 
@@ -126,6 +145,7 @@ int main(void)
 	} else if (box_type == BOX_TYPE_POKEY) {
 		pokey_init();
 	}
+	session_log_init();
 	
 	//TODO seed rng from adc read of unconnected line
 	
@@ -134,20 +154,20 @@ int main(void)
 		HID_Device_USBTask(&Generic_HID_Interface);
 		USB_USBTask();
 		adc_task();
+		debounce_tick(millis());
+		
+		// the report callback runs whenever the IN bank is free, so a long silence means the host stopped reading
+		if (time_synced && (millis() - last_in_poll) > HOST_LINK_TIMEOUT)
+			link_down();
 		
-		box_flash_handler();
 		box_tick();
+		session_log_task();
 		if (box_type == BOX_TYPE_PEGGY) {
 			peggy_stm_loop();
 		} else if (box_type == BOX_TYPE_POKEY) {
 			read_buttons(); // pokey
 			pokey_loop();
-			pokey_flash_handler();
 		}
-		
-		
-		//PORTB &= ~(1<<PB0); // written down to keep it down, not clear why
-		
 	}
 }
 
@@ -185,32 +205,34 @@ void SetupHardware(void)
 #endif
 
 	/* Hardware Initialization */
-	LEDs_Init();
+	//no LUFA board LEDs: on the Leonardo they sit on PB0, the mux enable, and PD5, and the led engine owns the rest
 	USB_Init();
 }
 
 /** Event handler for the library USB Connection event. */
 void EVENT_USB_Device_Connect(void)
 {
-	LEDs_SetAllLEDs(LEDMASK_USB_ENUMERATING);
 }
 
 /** Event handler for the library USB Disconnection event. */
 void EVENT_USB_Device_Disconnect(void)
 {
-	LEDs_SetAllLEDs(LEDMASK_USB_NOTREADY);
+	link_down();
+}
+
+/** Event handler for the library USB Suspend event. */
+void EVENT_USB_Device_Suspend(void)
+{
+	link_down();
 }
 
 /** Event handler for the library USB Configuration Changed event. */
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
-	bool ConfigSuccess = true;
-
-	ConfigSuccess &= HID_Device_ConfigureEndpoints(&Generic_HID_Interface);
+	link_down();
+	HID_Device_ConfigureEndpoints(&Generic_HID_Interface);
 
 	USB_Device_EnableSOFEvents();
-
-	LEDs_SetAllLEDs(ConfigSuccess ? LEDMASK_USB_READY : LEDMASK_USB_ERROR);
 }
 
 /** Microsoft OS 2.0 Descriptor. This is used by Windows to select the USB driver for the device.
@@ -315,7 +337,6 @@ void EVENT_USB_Device_StartOfFrame(void)
  *
  *  \return Boolean \c true to force the sending of the report, \c false to let the library determine if it needs to be sent
  */
-int times;
 bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
                                          uint8_t* const ReportID,
                                          const uint8_t ReportType,
@@ -330,145 +351,74 @@ bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDIn
 	//const uint8_t* strchars;
 	//uint16_t cb_strlen;
 	//uint16_t strlen_rem;
-	static int times;
 	UNUSED(HIDInterfaceInfo);
 	switch (ReportType) {
 	case HID_REPORT_ITEM_Feature:
 		if (*ReportID == MSG_CONFIG_ID) {
-			//return the current timeout
-			uint32_to_wire(timeout, Data);
-			Data+=4;
-			uint16_to_wire(wall_error_timeout, Data);
-			Data+=2;
-			if (box_type == BOX_TYPE_POKEY) {
-				memcpy(Data, target_order, 10);
-				*ReportSize = MSG_CONFIG_SIZE_POKEY;
-			} else {
-				*ReportSize = MSG_CONFIG_SIZE_PEGGY;
-			}
+			//return the current timeout, item_order is cut off for peggy by the report length
+			pack_config(Data, timeout, wall_error_timeout, wall_error_merge, target_order);
+			*ReportSize = REPORT_LEN(config);
 			return true;
-		} else if (*ReportID == 69) {
-			Data[0] = get_box_type();
-			*ReportSize = 1;
+		} else if (*ReportID == BOX_TYPE_ID) {
+			pack_box_type(Data, get_box_type());
+			*ReportSize = sizeof(struct report_box_type);
 			return true;
-		} else if (*ReportID == 70) {
+		} else if (*ReportID == HARDWARE_FAULT_ID) {
 			//TODO return hardware fault
-		} else if (*ReportID == 71) {
+		} else if (*ReportID == PEG_THRESHOLDS_ID) {
 			//return peg thresholds
+			uint16_t thresh[PEG_COUNT];
 			for (int i = 0; i < PEG_COUNT;i++)
-				uint16_to_wire(pegs[i].thresh, &Data[2*i]);
-			*ReportSize = 12;
+				thresh[i] = pegs[i].thresh;
+			pack_peg_thresholds(Data, thresh);
+			*ReportSize = sizeof(struct report_peg_thresholds);
 			return true;
-		}
-		break;
-	case HID_REPORT_ITEM_In:
-		//send start, task success, end messages
-		//send error messages
-	
-		if (send_status) {
-			send_status = 0;
-			status_sent = 1;
-			//timestamp
-			time_to_wire(host_millis(), Data);
-			//status
-			uint32_to_wire(status, Data+8);
-			
-			*ReportID = MSG_STATUS_ID;
-			*ReportSize = MSG_STATUS_SIZE;
+		} else if (*ReportID == PEG_DRIFT_ID) {
+			uint16_t open[PEG_COUNT], covered[PEG_COUNT], margin[PEG_COUNT];
+			int16_t drift[PEG_COUNT];
+			for (int i = 0; i < PEG_COUNT; i++) {
+				open[i] = pegs[i].open_lvl >> PEG_TRACK_FRAC;
+				covered[i] = pegs[i].covered_lvl >> PEG_TRACK_FRAC;
+				drift[i] = (int16_t)pegs[i].thresh - (int16_t)settings.peg_thresh[i];
+				margin[i] = peg_margin(&pegs[i]);
+			}
+			pack_peg_drift(Data, open, covered, drift, margin);
+			*ReportSize = sizeof(struct report_peg_drift);
 			return true;
-		}
-		// Eventbufs must be first because we cannot lose them and that will not happen if there is a connection
-		//send event MSG_EVENT_ID
-		//TODO FEATURE add output repot on this number that toggles sending these on or off
-		if (0){//evtbuf.occupancy) {
-			extract_event(&evtbuf, Data, MSG_EVENT_SIZE);
-			*ReportID = MSG_EVENT_ID;
-			*ReportSize = MSG_EVENT_SIZE;
+		} else if (*ReportID == TOOL_THRESHOLDS_ID) {
+			uint16_t thresh[TOOL_LINE_COUNT*2];
+			for (int i = 0; i < TOOL_LINE_COUNT; i++) {
+				thresh[2*i] = settings.tool_thresh[i].lo;
+				thresh[2*i+1] = settings.tool_thresh[i].hi;
+			}
+			pack_tool_thresholds(Data, thresh);
+			*ReportSize = sizeof(struct report_tool_thresholds);
 			return true;
-		}
-		//send poke event on MSG_POKE_ID
-		if (pokebuf.occupancy) {
-			extract_poke(&pokebuf, Data, MSG_POKE_SIZE);
-			*ReportID = MSG_POKE_ID;
-			*ReportSize = MSG_POKE_SIZE;
+		} else if (*ReportID == SERIAL_NUMBER_ID) {
+			pack_serial_number(Data, (const uint8_t *)settings.serial);
+			*ReportSize = sizeof(struct report_serial_number);
 			return true;
-		}
-		//send peg event on MSG_PEG_ID
-		if (peg_msg_pending) {
-			for (int i = 0; i < PEG_COUNT; i++) {
-				uint8_t flag = (1<<i);
-				if (peg_msg_pending & flag) {
-					//stamp 8byte
-					time_to_wire(peg_stamps[i],Data);
-					//loc byte
-					Data[8] = i;
-					//newst byte
-					Data[9] = !!(peg_msg_state & flag);
-					peg_msg_pending &= ~flag;
-					*ReportID = MSG_PEG_ID;
-					*ReportSize = MSG_PEG_SIZE;
-					return true;
-				} else {
-					//continue,it will be a later one
-				}
-			}
-		}
-		//send wall_error report on MSG_WALL_ERROR_ID
-		if (werrbuf.occupancy) {
-			extract_wall_error(&werrbuf, Data, MSG_WALL_ERROR_SIZE);
-			*ReportID = MSG_WALL_ERROR_ID;
-			*ReportSize = MSG_WALL_ERROR_SIZE;
+		} else if (*ReportID == SESSION_LOG_ID) {
+			//next page of the on-device session log
+			*ReportSize = session_log_page(Data);
 			return true;
-		}
-		//send drop_error report on MSG_DROP_ERROR_ID
-		if (derrbuf.occupancy) {
-			extract_drop_error(&derrbuf, Data, MSG_DROP_ERROR_SIZE);
-			*ReportID = MSG_DROP_ERROR_ID;
-			*ReportSize = MSG_DROP_ERROR_SIZE;
+		} else if (*ReportID == REPORT_LATENCY_ID) {
+			*ReportSize = report_sched_latency(Data);
 			return true;
-		}
-		//send tool state transition event on MSG_TOOL_ID
-		//this records whether it's in or out, not the tool state
-		// don't send until status is sent, so that first response to timestamp is correct
-		if (toolbuf.occupancy && status_sent) {
-			extract_tool(&toolbuf, Data, MSG_TOOL_SIZE);
-			*ReportID = MSG_TOOL_ID;
-			*ReportSize = MSG_TOOL_SIZE;
+		} else if (*ReportID == CONTACT_METRICS_ID) {
+			*ReportSize = contact_metrics(Data);
 			return true;
-		}
-		
-		//if send_raw then send raw values on 69
-		if (send_raw) { //implicitly nothing else needs to be sent now
-			//ratelimit because chrome
-			times++;
-			if (times < 100) return false;
-			times = 0;
-			
-			//send all 3 tool adcs
-			uint16_to_wire(adc_values[TOOL_ERROR_LINE], Data+0);
-			uint16_to_wire(adc_values[TOOL_HOLDER_LINE], Data+2);
-			uint16_to_wire(adc_values[TOOL_CONNECTED_LINE], Data+4);
-			
-			Data+=6;
-			
-			//send all 6+1 peggy optic adcs
-			uint16_to_wire(adc_values[0], Data+0);
-			uint16_to_wire(adc_values[1], Data+2);
-			uint16_to_wire(adc_values[4], Data+4);
-			uint16_to_wire(adc_values[5], Data+6);
-			uint16_to_wire(adc_values[6], Data+8);
-			uint16_to_wire(adc_values[7], Data+10);
-			uint16_to_wire(adc_values[DROP_ERROR_LINE], Data+12);
-			
-			Data += 14;
-			
-			//send all 10 pokey buttons
-			memcpy(Data,button_values,10);
-			
-			*ReportSize = (3+7)*2 + 10;
-			*ReportID = 69;
+		} else if (*ReportID == PEG_CALIBRATION_ID) {
+			*ReportSize = peg_cal_report(Data);
 			return true;
 		}
+		break;
+	case HID_REPORT_ITEM_In:
+		//send start, task success, end messages
+		//send error messages
+		last_in_poll = millis();
+		// Keep events queued until there is a host clock to stamp them with; only status and raw values go out before
+		return report_sched_next(Data, ReportID, ReportSize, time_synced);
 	}
 	return false;
 }
@@ -490,24 +440,44 @@ void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDI
 	uint8_t* Data = (uint8_t*)ReportData;
 	//uint8_t  NewLEDMask = LEDS_NO_LEDS;
 	UNUSED(HIDInterfaceInfo);
-	UNUSED(ReportSize);
 	switch (ReportType) {
 	case HID_REPORT_ITEM_Feature:
 		if (ReportID == START_BOOTLOADER_REPORT_ID) {
 			//check that proper code was supplied
 			//FIXME lol always succeed
 			//start bootloader
-			LEDs_SetAllLEDs(LEDS_LED1|LEDS_LED2|LEDS_LED3);
 			Jump_To_Bootloader();
-		} else if (ReportID == 69) {
-			set_box_type(Data[0]);
+		} else if (ReportID == BOX_TYPE_ID) {
+			uint8_t v;
+			unpack_box_type(Data, &v);
+			set_box_type(v);
 		} else if (ReportID == MSG_CONFIG_ID) {
-			//set timestamp, wall timeout, and task order
-			timeout = uint32_from_wire(Data);
-			Data+=4;
-			wall_error_timeout = Data[0]<<8 | Data[1];
-			Data+=2;
-			if (box_type == BOX_TYPE_POKEY) {
+			//set timestamp, wall timeout, merge window and task order
+			uint8_t order[TARGET_COUNT];
+			uint8_t r[sizeof(struct report_config)] = {0};
+			uint8_t head = offsetof(struct report_config, merge_window);
+			uint8_t legacy = ReportSize < REPORT_LEN(config);
+			uint16_t have = ReportSize;
+			ms_time_t t;
+			uint16_t thresh, merge;
+			//hosts from before merge_window send the same layout without it, so a short report is read that way
+			if (legacy) {
+				memcpy(r, Data, ReportSize < head ? ReportSize : head);
+				if (ReportSize > head)
+					memcpy(r + head + sizeof(((struct report_config *)0)->merge_window), Data + head, ReportSize - head);
+				have += sizeof(((struct report_config *)0)->merge_window);
+			} else {
+				memcpy(r, Data, REPORT_LEN(config));
+			}
+			unpack_config(r, &t, &thresh, &merge, order);
+			//only the fields the host sent
+			if (have >= offsetof(struct report_config, error_threshold))
+				timeout = t;
+			if (have >= offsetof(struct report_config, merge_window))
+				wall_error_timeout = thresh;
+			wall_error_merge = legacy ? WALL_ERROR_MERGE_DEFAULT : merge;
+			Data = order;
+			if (box_type == BOX_TYPE_POKEY && have >= POKEY_LEN_config) {
 				int allmax = 1;
 				//check that these are actually 0-9
 				for (int i = 0; i < 10; i++) {
@@ -524,33 +494,69 @@ void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDI
 					memcpy(target_order, Data, 10);
 				}
 			}
-		} else if (ReportID == 71) {
-			//update peg thresholds in eeprom
-			//hard 6 because it doesn't magically update if I change the number of pegs
-			//PEG_COUNT so that looking for it will find that it is used here
-			for (int i = 0; i < 6; i++) {
-				pegs[i].thresh = uint16_from_wire(&Data[2*i]);
+		} else if (ReportID == PEG_THRESHOLDS_ID) {
+			//update stored peg thresholds
+			uint16_t thresh[PEG_COUNT];
+			unpack_peg_thresholds(Data, thresh);
+			for (int i = 0; i < PEG_COUNT; i++) {
+				pegs[i].thresh = thresh[i];
 			}
 			write_peggy_thresholds();
+		} else if (ReportID == PEG_DRIFT_ID) {
+			read_peggy_thresholds();
+		} else if (ReportID == TOOL_THRESHOLDS_ID) {
+			//update stored tool line hysteresis bands, a band off the adc range or narrower than the minimum is ignored
+			uint16_t thresh[TOOL_LINE_COUNT*2];
+			if (ReportSize < REPORT_LEN(tool_thresholds)) break;
+			unpack_tool_thresholds(Data, thresh);
+			for (int i = 0; i < TOOL_LINE_COUNT; i++) {
+				uint16_t lo = thresh[2*i], hi = thresh[2*i+1];
+				if (hi <= TOOL_THRESH_MAX && hi >= TOOL_THRESH_MIN_WIDTH && lo <= hi - TOOL_THRESH_MIN_WIDTH) {
+					settings.tool_thresh[i].lo = lo;
+					settings.tool_thresh[i].hi = hi;
+				}
+			}
+			settings_save();
+		} else if (ReportID == SERIAL_NUMBER_ID) {
+			//provisioning, refused once a serial is stored
+			set_serial_number(Data, ReportSize);
+		} else if (ReportID == REPORT_LATENCY_ID) {
+			report_sched_latency_clear();
+		} else if (ReportID == CONTACT_METRICS_ID) {
+			contact_metrics_clear();
+		} else if (ReportID == PEG_CALIBRATION_ID && box_type == BOX_TYPE_PEGGY && ReportSize >= 1) {
+			if (Data[0] == PEG_CAL_OPEN)
+				peg_cal_start();
+			else if (Data[0] == PEG_CAL_IDLE)
+				peg_cal_abort();
 		}
 		break;
 	case HID_REPORT_ITEM_Out:
 		//process commands from chrome app
 		if (ReportID == TIMESTAMP_OFFSET_FR_ID) {
+			// Queued events hold device time, so setting the offset is all the rebasing they need
 			TIME_t oset;
-			oset = time_from_wire(Data);
+			unpack_timestamp(Data, &oset);
 			set_time_oset(oset);
-			send_status = 1;
-			lms_said_to_start = 1; // Also restarts the task completely.
+			report_sched_status();
+			// Also restarts the task completely, unless this is the host coming back after losing the link mid-task
+			if (!(link_lost && task_in_progress())) {
+				lms_said_to_start = 1;
+				contact_metrics_clear();
+			}
+			link_lost = 0;
+			time_synced = 1;
+			last_in_poll = millis();
 			// TODO set a flag that controls box type auto-detection so that it doesn't run until there has been a message from a computer received. This will prevent bare boards incorrectly autoconfiguring themselves.
-			// Fixup the timestamps of the tool buffer because one was being put in early. Direct call is much less space than funtion call.
-			for (int i = 0; i < TOOL_BUFFER_SIZE;i++)
-				toolbuf.stamps[i] += oset;
-			
-			// Do not send initial messages, but rather use status for that information. Because any messages in the "buffer" will not be sent, do not bother updating the timestamps
-			peg_msg_pending = 0;
-		} else if (ReportID == 69) {
+		} else if (ReportID == RAW_VALUES_ID) {
 			send_raw = !send_raw;
+		} else if (ReportID == SESSION_LOG_ID) {
+			uint8_t page;
+			unpack_session_log_page(Data, &page);
+			if (page == SESSION_LOG_ERASE)
+				session_log_erase();
+			else
+				session_log_seek(page);
 		}
 		break;
 	}
@@ -43,6 +43,7 @@
 		#include <avr/interrupt.h>
 		#include <util/delay.h>
 		#include <stdlib.h>
+		#include <stddef.h>
 		
 		#include "Descriptors.h"
 		#include "Config/AppConfig.h"
@@ -54,32 +55,25 @@
 		#include "adc.h"
 		#include "pokey.h"
 		#include "peggy.h"
+		#include "session_log.h"
+		#include "settings.h"
+		#include "reports.h"
+		#include "report_sched.h"
+		#include "sound.h"
+		#include "debounce.h"
 		#include "debug.h"
 
 		#include <LUFA/Common/Common.h>
-		#include <LUFA/Drivers/Board/LEDs.h>
 		#include <LUFA/Drivers/USB/USB.h>
 		#include <LUFA/Platform/Platform.h>
 
-	/* Macros: */
-		/** LED mask for the library LED driver, to indicate that the USB interface is not ready. */
-		#define LEDMASK_USB_NOTREADY      LEDS_LED1
-
-		/** LED mask for the library LED driver, to indicate that the USB interface is enumerating. */
-		#define LEDMASK_USB_ENUMERATING  (LEDS_LED2 | LEDS_LED3)
-
-		/** LED mask for the library LED driver, to indicate that the USB interface is ready. */
-		#define LEDMASK_USB_READY        (LEDS_LED2 | LEDS_LED4)
-
-		/** LED mask for the library LED driver, to indicate that an error has occurred in the USB interface. */
-		#define LEDMASK_USB_ERROR        (LEDS_LED1 | LEDS_LED3)
-
 	/* Function Prototypes: */
 		void Bootloader_Jump_Check(void) ATTR_INIT_SECTION(3);
 		void SetupHardware(void);
 
 		void EVENT_USB_Device_Connect(void);
 		void EVENT_USB_Device_Disconnect(void);
+		void EVENT_USB_Device_Suspend(void);
 		void EVENT_USB_Device_ConfigurationChanged(void);
 		void EVENT_USB_Device_ControlRequest(void);
 		void EVENT_USB_Device_StartOfFrame(void);
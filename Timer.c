@@ -1,5 +1,6 @@
 #include "Timer.h"
 #include "Config/AppConfig.h"
+#include "contact.h"
 
 /* will rollover once every ~50 days */
 volatile ms_time_t cur_millis = 0;
@@ -59,6 +60,7 @@ MODULE_INIT(timer)
 ISR(TIMER0_COMPA_vect)
 {
 	cur_millis++;
+	contact_sample(cur_millis);
 }
 
 ms_time_t millis(void)
@@ -71,6 +73,11 @@ TIME_t host_millis(void) {
 	return time_oset + cur_millis;
 }
 
+/* events are stamped with device millis and converted on the way out, so a new offset rebases everything still queued */
+TIME_t host_time(ms_time_t device_ms) {
+	return time_oset + device_ms;
+}
+
 void set_time_oset(TIME_t t)
 {
 	ms_time_t cur = cur_millis;
@@ -11,6 +11,7 @@
 
 	ms_time_t millis(void);
 	TIME_t host_millis(void);
+	TIME_t host_time(ms_time_t device_ms);
 	
 	MODULE_TASK(timer);
 	MODULE_INIT(timer);
@@ -32,6 +32,21 @@ uint16_t uint16_from_wire(const uint8_t w[])
 	ret = (w[0]<<8) + w[1];
 	return ret;
 }
+/* any little-endian integer of n bytes, for the generated report packers */
+void bytes_to_wire(const void *v, uint8_t n, uint8_t w[])
+{
+	const uint8_t *b = v;
+	for (uint8_t i = 0; i < n; i++) {
+		w[i] = b[n-1-i];
+	}
+}
+void bytes_from_wire(void *v, uint8_t n, const uint8_t w[])
+{
+	uint8_t *b = v;
+	for (uint8_t i = 0; i < n; i++) {
+		b[n-1-i] = w[i];
+	}
+}
 union float_byteview {
 	float val;
 	uint8_t u8s[4];
@@ -4,3 +4,5 @@ void uint16_to_wire(uint16_t v, uint8_t w[]);
 uint16_t uint16_from_wire(const uint8_t w[]);
 void float_to_wire(float f, uint8_t w[]);
 float float_from_wire(const uint8_t w[]);
+void bytes_to_wire(const void *v, uint8_t n, uint8_t w[]);
+void bytes_from_wire(void *v, uint8_t n, const uint8_t w[]);
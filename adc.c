@@ -1,5 +1,8 @@
 #include <stdint.h>
 #include <avr/io.h>
+#include "Timer.h"
+#include "adc.h"
+#include "contact.h"
 uint16_t adc_values[13];
 
 uint16_t adc_read(int pin) {
@@ -23,9 +26,21 @@ uint16_t adc_read(int pin) {
 	return (hi << 8) | lo;
 }
 
-void adc_task(void) {
+void adc_sweep(void) {
 	int i;
+	//the comparator watches wall contact whenever the ADC is not sweeping
+	contact_ac_disarm();
 	for (i = 0; i < 13; i++) {
 		adc_values[i] = adc_read(i);
 	}
+	contact_ac_arm();
+}
+
+//sweeps on a fixed period rather than every pass, so the comparator has the mux most of the time
+void adc_task(void) {
+	static ms_time_t last;
+	ms_time_t now = millis();
+	if (now - last < ADC_SWEEP_MS) return;
+	last = now;
+	adc_sweep();
 }
\ No newline at end of file
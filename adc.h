@@ -1,3 +1,8 @@
 uint16_t adc_values[13];
+// ms between sweeps, each leaves the wall line unwatched for ADC_SWEEP_US (see contact.h)
+#ifndef ADC_SWEEP_MS
+#define ADC_SWEEP_MS 8
+#endif
 uint16_t adc_read(int pin);
+void adc_sweep(void);
 void adc_task(void);
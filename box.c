@@ -4,31 +4,36 @@
 #include "box.h"
 #include "adc.h"
 #include "WireConversions.h"
-#include <avr/eeprom.h>
+#include "session_log.h"
+#include "settings.h"
+#include "reports.h"
+#include "sound.h"
+#include "debounce.h"
+#include "contact.h"
+#include "peggy.h"
+#include <avr/pgmspace.h>
 #define UNUSED(x) (void)x
 
-//FIXME write a generic debouncer and replace all current debouncers with it
 //TODO both boxes: don't care about errors after task completed
 uint32_t status;
-uint8_t tool_was_in_slot;
-#define BOX_TYPE_EEPROM_ADDR ((uint8_t*)13)
 #define BOX_KNOWN_TYPES 2
 void
 set_box_type(uint8_t x)
 {
-	eeprom_update_byte(BOX_TYPE_EEPROM_ADDR, x);
+	settings.box_type = x;
+	settings_save();
 }
 uint8_t
 get_box_type(void)
 {
-	return eeprom_read_byte(BOX_TYPE_EEPROM_ADDR);
+	return settings.box_type;
 }
 uint8_t
 determine_box_type(void)
 {
-	// read eeprom location for box type. If 0, autodetermine and set. If nonzero, be that. If it's a value above the known types, act as if it was zero.
+	// read stored box type. If 0, autodetermine and set. If nonzero, be that. If it's a value above the known types, act as if it was zero.
 	//this was tested with a pokey and peggy and worked for both
-	uint8_t v = eeprom_read_byte(BOX_TYPE_EEPROM_ADDR);
+	uint8_t v = settings.box_type;
 	if (v && v <= BOX_KNOWN_TYPES) return v;
 	
 	uint16_t val = 0;
@@ -41,109 +46,73 @@ determine_box_type(void)
 		//all high: pokey
 		v = BOX_TYPE_POKEY;
 	}
-	eeprom_write_byte(BOX_TYPE_EEPROM_ADDR, v);
+	set_box_type(v);
 	return v;
 }
 
 // explicitly initializing to 0 to indicate that it's unlimited by default
 ms_time_t timeout = 0;
-void
-buzzer_init(void)
-{
-	//set up timer and pwm
-	//page 164 and following
-	
-	TCCR4A = (1<<PWM4B) | (1<<COM4B0);
-	TCCR4B = (1<<CS42)|(1<<CS41); /* set prescaler to 1/32 */
-	TCCR4D &= ~0x03;
-}
-inline void
-buzzer_set_duty_cycle(uint8_t x)
-{
-	//assign to pwm compare register
-	OCR4B = x;
-}
-void
-buzzer_on(void) {buzzer_set_duty_cycle(0xf0);}
-void
-buzzer_off(void) {buzzer_set_duty_cycle(0);}
-
-struct led buzzer_as_led = {.on = buzzer_on, .off = buzzer_off};
-
-//FIXME fix this mess
-#define AS_USE_LEDS(dir, name, led, port, ddr, num) led(dir, name, port, ddr, num)
-
-#define AS_LED_ON_DECL(name, port, ddr, num) void name ## _on(void);
-
-#define __notled__(dir, name, port, ddr, num)
-#define __led__(dir, name, port, ddr, num) AS_LED_ON_DECL(name, port, ddr, num)
-//make declarations
-BOX_HARDWARE_TABLE(AS_USE_LEDS);
-#undef __notled__
+#define AS_BOX_LED(dir, name, led, port, ddr, num) led(name, port, ddr, num)
+#define __notled__(name, port, ddr, num)
+#define __led__(name, port, ddr, num) AS_LED_PIN(name, port, ddr, num)
+BOX_HARDWARE_TABLE(AS_BOX_LED)
 #undef __led__
-
-#define AS_LED_OFF_DECL(name, port, ddr, num) void name ## _off(void);
-#define __notled__(dir, name, port, ddr, num)
-#define __led__(dir, name, port, ddr, num) AS_LED_OFF_DECL(name, port, ddr, num)
-// make declarations
-BOX_HARDWARE_TABLE(AS_USE_LEDS);
-#undef __notled__
-#undef __led__
-
-#define AS_LED_ON_FUN(name, port, ddr, num) void name ## _on(void) \
-  {port |= (1<<num);}
-#define __notled__(dir, name, port, ddr, num)
-#define __led__(dir, name, port, ddr, num) AS_LED_ON_FUN(name, port, ddr, num)
-// make declarations
-  BOX_HARDWARE_TABLE(AS_USE_LEDS);
-#undef __notled__
+#define __led__(name, port, ddr, num) {.pin = &led_pin_ ## name},
+#define BOX_LED_NUM 2
+struct led box_leds[BOX_LED_NUM] = {BOX_HARDWARE_TABLE(AS_BOX_LED)};
 #undef __led__
-  
-#define AS_LED_OFF_FUN(name, port, ddr, num) void name ## _off(void) \
-  {port &= ~(1<<num);}
-#define __notled__(dir, name, port, ddr, num)
-#define __led__(dir, name, port, ddr, num) AS_LED_OFF_FUN(name, port, ddr, num) 
-// make declarations
-  BOX_HARDWARE_TABLE(AS_USE_LEDS);
 #undef __notled__
-#undef __led__
-  
-//not needed, done all at once
-//#define AS_ENABLE_OUTPUT(name, port, ddr, num) ddr |= (1<<num);
-  
-
-#define __notled__(dir, name, port, ddr, num)
-#define __led__(dir, name, port, ddr, num) {.on = name ## _on, .off = name ## _off},
-#define BOX_LED_NUM 2
-struct led box_leds[BOX_LED_NUM] = {BOX_HARDWARE_TABLE(AS_USE_LEDS)};
 
 struct led *error_led = &box_leds[0];
 
 #define FOREACH_BOX_LED(key) \
   for (struct led *key=box_leds;key<&box_leds[BOX_LED_NUM];key++)
 
-void
-box_flash_handler(void)
-{
-	ms_time_t now = millis();
-	FOREACH_BOX_LED(l) do_flashing(l, now);
-	do_flashing(&buzzer_as_led, now);
-}
-
 void
 box_test_leds(void)
 {
-	FOREACH_BOX_LED(l) start_flashing(l,-1,250,500);
+	FOREACH_BOX_LED(l) start_flashing(l,LED_FLASH_FOREVER,250,500);
 }
 
 #define out(name, ddr, num) ddr |= (1<<num);
 #define in(name, ddr, num) ddr &= ~(1<<num);
 #define AS_DIRECTION_SETUP(dir, name, led, port, ddr, num) dir(name,ddr,num);
+#define AS_TOOL_LINE_COUNT(name, line) + 1
+_Static_assert(0 TOOL_LINES(AS_TOOL_LINE_COUNT) == TOOL_LINE_COUNT, "settings.h sizes the tool thresholds for TOOL_LINES");
+static uint8_t line_high;
+static const uint16_t tool_dwell[] PROGMEM = TOOL_DWELL_TABLE;
+static tool_state tool_candidate;
+static ms_time_t candidate_since;
+
+static uint8_t
+tool_line(uint8_t i)
+{
+	return !!(line_high & (1 << i));
+}
+
+//updates every line's level and returns the margin of line i from the threshold that would flip it
+#define AS_TOOL_LINE_READ(name, line) margin[TOOL_LINE_##name] = tool_line_read(TOOL_LINE_##name, adc_values[line]);
+static uint8_t
+tool_line_read(uint8_t i, uint16_t v)
+{
+	const struct tool_thresh *t = &settings.tool_thresh[i];
+	uint16_t m;
+
+	if (v > t->hi)
+		line_high |= (1 << i);
+	else if (v < t->lo)
+		line_high &= ~(1 << i);
+	m = tool_line(i) ? (v > t->lo ? v - t->lo : 0) : (t->hi > v ? t->hi - v : 0);
+	return m > UINT8_MAX ? UINT8_MAX : m;
+}
+
 void
 box_init(void)
 {
 	BOX_HARDWARE_TABLE(AS_DIRECTION_SETUP);
-	tool_was_in_slot = tool_in_slot();
+	FOREACH_BOX_LED(l) led_register(l);
+	debounce_preset(DB_tool_in, tool_line(TOOL_LINE_holder));
+	debounce_preset(DB_tool_gone, cur_tool == NO_TOOL);
 	/*
 	in, tool_connected?, PORTB, PB5
 	out, buzzer, PORTB, PB6
@@ -154,62 +123,96 @@ box_init(void)
 }
 
 uint16_t wall_error_timeout = 350;
-int error;
-uint8_t error_end_recorded;
-ms_time_t last_err_time, err_early_end_time;
-TIME_t host_err_time;
+uint16_t wall_error_merge = WALL_ERROR_MERGE_DEFAULT;
+
+/* One error episode: contacts that follow each other within wall_error_merge. It closes once the tool has been off
+ * the wall for the merge window, and only then is it reported, once, with everything it took in. */
+static struct {
+	ms_time_t start; // first contact
+	ms_time_t contact_start; // current contact
+	ms_time_t last_end; // end of the latest contact
+	uint32_t total; // contact time of the finished contacts
+	uint16_t peak_gap;
+	uint8_t contacts;
+	uint8_t open : 1;
+	uint8_t in_contact : 1;
+} ep;
+
 void
 handle_wall_errors(void)
 {
-	// TODO this should work in a different way, so that it waits for the current error to end, then waits the delay time. If no new error happens in that time, send the old one, otherwise add the time to this one
-	// TODO currently there is some fancy buzzer management code but it can be avoided with start_flashing(&buzzer_as_led, 1, BUZZER_LENGTH, 0);
-	// if it is short and no other one happens, provide the short duration. This means that this can't use the debouncing code
-    if (cur_tool == WALL_ERROR_OK) {
-		if (!error) {
-			error = 1;
-			last_err_time = millis();
-			host_err_time = host_millis();
-			buzzer_on();
-			error_led->on();
+	// the beep is a held cue: it starts with each contact, is released when it ends and lasts at least MIN_BUZZER_LENGTH
+	// start and end come from the contact queue with the interrupt's stamps, not from when this loop got to them
+	struct contact_edge e;
+	while (contact_pop(&e)) {
+		if (e.level) {
+			//contact without the tool plugged in is the hardware fault box_tick reports, not a student error
+			if (!tool_line(TOOL_LINE_jack)) continue;
+			if (!ep.open) {
+				ep.open = 1;
+				ep.start = e.stamp;
+				ep.total = 0;
+				ep.peak_gap = 0;
+				ep.contacts = 0;
+				led_turn_on(error_led);
+			} else if (!ep.in_contact) {
+				ms_time_t gap = e.stamp - ep.last_end;
+				if (gap > ep.peak_gap)
+					ep.peak_gap = gap > UINT16_MAX ? UINT16_MAX : gap;
+			}
+			sound_play(SOUND_wall_error);
+			if (ep.contacts < UINT8_MAX)
+				ep.contacts++;
+			ep.in_contact = 1;
+			ep.contact_start = e.stamp;
+		} else if (ep.open && ep.in_contact) {
+			contact_metrics_note(e.stamp - ep.contact_start);
+			ep.total += e.stamp - ep.contact_start;
+			ep.last_end = e.stamp;
+			ep.in_contact = 0;
+			sound_release();
 		}
-		error_end_recorded = 0;
-    }
-	if (error && cur_tool != WALL_ERROR_OK && !error_end_recorded) {
-		err_early_end_time = millis();
-		error_end_recorded = 1;
 	}
-    if (error
-			&& ((millis() - last_err_time) > MIN_BUZZER_LENGTH)
-			&& cur_tool != WALL_ERROR_OK) {
-		if (!error_end_recorded) //I don't think this will ever execute
-			err_early_end_time = millis();
-		buzzer_off();
-		error_led->off();
-		ms_time_t elapsed = err_early_end_time - last_err_time;
-		error = 0;
-		error_end_recorded = 0;
+	if (ep.open && !ep.in_contact && (millis() - ep.last_end) > wall_error_merge
+			&& (millis() - ep.start) > MIN_BUZZER_LENGTH) {
+		led_turn_off(error_led);
+		ep.open = 0;
 		//store error report in buffer
-		if (elapsed >= wall_error_timeout)
-			new_wall_error(&werrbuf, host_err_time, elapsed);
+		if (ep.total >= wall_error_timeout) {
+			new_wall_error(&werrbuf, ep.start, ep.total, ep.contacts, ep.peak_gap);
+			session_note_wall_error(ep.total);
+		}
 	}
 }
 void
 reset_wall_errors(void)
 {
-	error = 0;
+	//an episode cut off here would otherwise leave its LED and held beep on
+	if (ep.open)
+		led_turn_off(error_led);
+	if (ep.in_contact)
+		sound_release();
+	ep.open = 0;
+	ep.in_contact = 0;
+	contact_flush();
 }
 
 int
 tool_in_slot(void)
 {
 	//return if the tool is in
-	return (cur_tool == NO_TOOL) ? 2 : adc_values[TOOL_HOLDER_LINE] > 512;
+	return (cur_tool == NO_TOOL) ? 2 : tool_line(TOOL_LINE_holder);
 }
-tool_state
-classify_tool(int tool_error, int tool_jack)
+static tool_state
+classify_tool(void)
 {
-	tool_error = tool_error < 512;
-	tool_jack = tool_jack > 512;
+	uint8_t margin[TOOL_LINE_COUNT];
+	TOOL_LINES(AS_TOOL_LINE_READ)
+	tool_confidence = margin[TOOL_LINE_error] < margin[TOOL_LINE_jack] ? margin[TOOL_LINE_error] : margin[TOOL_LINE_jack];
+
+	//the error line is pulled low by contact
+	uint8_t tool_error = !tool_line(TOOL_LINE_error);
+	uint8_t tool_jack = tool_line(TOOL_LINE_jack);
 	tool_state err;
 	if (tool_error) {
 		if (tool_jack) {
@@ -229,14 +232,18 @@ classify_tool(int tool_error, int tool_jack)
 	return err;
 }
 
-#define TOOL_DELAY 200
 #define TOOL_STATE_FOOTPRINT 3
 void
 box_tick(void)
 {
-	cur_tool = classify_tool(
-		adc_values[TOOL_ERROR_LINE], adc_values[TOOL_CONNECTED_LINE]
-	);
+	tool_state s = classify_tool();
+	ms_time_t now = millis();
+	if (s != tool_candidate) {
+		tool_candidate = s;
+		candidate_since = now;
+	}
+	if (s != cur_tool && now - candidate_since >= pgm_read_word(&tool_dwell[s]))
+		cur_tool = s;
 	
 	if (cur_tool == WALL_ERROR_WRONG) {
 		//set part of status, thereby notifying lms
@@ -245,39 +252,30 @@ box_tick(void)
 		status &= ~BAD_TOOL_STATUS_F;
 	}
 	
-	//TODO debounce properly
-	static uint8_t msg;
-	static uint8_t pending;
-	static TIME_t host_started;
-	static ms_time_t started;
-	static uint8_t last_msg_sent = -1;
-	uint8_t tool_in = tool_in_slot();
-	if (tool_in != tool_was_in_slot && tool_in != last_msg_sent) {
-		pending = 1;
-		msg = tool_was_in_slot = tool_in;
-		started = millis();
-		host_started = host_millis();
-	}
-	
-	if (pending && (millis()-started) > TOOL_DELAY) {
-		pending = 0;
+	//the same as tool_in_slot(), but from the debounced lines
+	debounce_put(DB_tool_in, tool_line(TOOL_LINE_holder));
+	debounce_put(DB_tool_gone, cur_tool == NO_TOOL);
+	static uint8_t last_msg_sent;
+	uint8_t msg = debounced(DB_tool_gone) ? 2 : debounced(DB_tool_in);
+	if (db_changed & (DB_BIT(DB_tool_in)|DB_BIT(DB_tool_gone)) && msg != last_msg_sent) {
 		status &= ~((uint32_t)TOOL_STATE_FOOTPRINT << 1);
 		status |= msg<<1;
-		new_tool(&toolbuf, host_started, last_msg_sent = msg);
+		new_tool(&toolbuf, debounce_onset(DB_tool_in, millis()), last_msg_sent = msg);
 	}
-	//new_tool(&toolbuf, host_millis(), tool_was_in_slot=tool_in);
 }
 
-void new_wall_error(struct wall_error_buffer *b, uint64_t stamp, ms_time_t dur)
+void new_wall_error(struct wall_error_buffer *b, ms_time_t stamp, ms_time_t dur, uint8_t contacts, uint16_t gap)
 {
 	if (b->occupancy >= WALL_ERROR_BUFFER_SIZE) return;
 	b->stamps[b->first_empty] = stamp;
 	b->durs[b->first_empty] = dur;
+	b->contacts[b->first_empty] = contacts;
+	b->gaps[b->first_empty] = gap;
 	b->occupancy++;
 	b->first_empty++;
 	b->first_empty %= WALL_ERROR_BUFFER_SIZE;
 }
-void new_drop_error(struct drop_error_buffer *b, uint64_t stamp)
+void new_drop_error(struct drop_error_buffer *b, ms_time_t stamp)
 {
 	if (b->occupancy >= DROP_ERROR_BUFFER_SIZE) return;
 	b->stamps[b->first_empty] = stamp;
@@ -285,7 +283,7 @@ void new_drop_error(struct drop_error_buffer *b, uint64_t stamp)
 	b->first_empty++;
 	b->first_empty %= DROP_ERROR_BUFFER_SIZE;
 }
-void new_poke(struct poke_buffer *b, uint64_t stamp, uint8_t loc)
+void new_poke(struct poke_buffer *b, ms_time_t stamp, uint8_t loc)
 {
 	if (b->occupancy >= POKE_BUFFER_SIZE) return;
 	b->stamps[b->first_empty] = stamp;
@@ -294,7 +292,18 @@ void new_poke(struct poke_buffer *b, uint64_t stamp, uint8_t loc)
 	b->first_empty++;
 	b->first_empty %= POKE_BUFFER_SIZE;
 }
-void new_tool(struct tool_buffer *b, uint64_t stamp, uint8_t newst)
+void new_peg(struct peg_buffer *b, ms_time_t stamp, uint8_t loc, uint8_t newst)
+{
+	if (b->occupancy >= PEG_BUFFER_SIZE) return;
+	b->stamps[b->first_empty] = stamp;
+	b->queued[b->first_empty] = millis();
+	b->locs[b->first_empty] = loc;
+	b->newsts[b->first_empty] = newst;
+	b->occupancy++;
+	b->first_empty++;
+	b->first_empty %= PEG_BUFFER_SIZE;
+}
+void new_tool(struct tool_buffer *b, ms_time_t stamp, uint8_t newst)
 {
 	if (b->occupancy >= TOOL_BUFFER_SIZE) return;
 	b->stamps[b->first_empty] = stamp;
@@ -303,9 +312,9 @@ void new_tool(struct tool_buffer *b, uint64_t stamp, uint8_t newst)
 	b->first_empty++;
 	b->first_empty %= TOOL_BUFFER_SIZE;
 }
-void new_event(struct event_buffer *eb, uint64_t stamp, uint8_t typ)
+void new_event(struct event_buffer *eb, ms_time_t stamp, uint8_t typ)
 {
-	if (eb->occupancy >= EVENT_BUFFER_SIZE)
+	if (eb->occupancy >= EVENT_BUFFER_SIZE) return;
 	eb->stamps[eb->first_empty] = stamp;
 	eb->typs[eb->first_empty] = typ;
 	eb->occupancy++;
@@ -315,10 +324,10 @@ void new_event(struct event_buffer *eb, uint64_t stamp, uint8_t typ)
 
 int extract_wall_error(struct wall_error_buffer *eb, uint8_t *buf, int buflen)
 {
-	if (buflen < (8 + 4) || !eb->occupancy) return -1;
+	if (buflen < (int)sizeof(struct report_wall_error) || !eb->occupancy) return -1;
 	
-	time_to_wire(eb->stamps[eb->first_real], buf);
-	uint32_to_wire(eb->durs[eb->first_real], &buf[8]);
+	pack_wall_error(buf, host_time(eb->stamps[eb->first_real]), eb->durs[eb->first_real],
+		eb->contacts[eb->first_real], eb->gaps[eb->first_real]);
 	eb->occupancy--;
 	eb->first_real++;
 	eb->first_real %= WALL_ERROR_BUFFER_SIZE;
@@ -326,9 +335,9 @@ int extract_wall_error(struct wall_error_buffer *eb, uint8_t *buf, int buflen)
 }
 int extract_drop_error(struct drop_error_buffer *eb, uint8_t *buf, int buflen)
 {
-	if (buflen < 8 || !eb->occupancy) return -1;
+	if (buflen < (int)sizeof(struct report_drop_error) || !eb->occupancy) return -1;
 	
-	time_to_wire(eb->stamps[eb->first_real], buf);
+	pack_drop_error(buf, host_time(eb->stamps[eb->first_real]));
 	eb->occupancy--;
 	eb->first_real++;
 	eb->first_real %= DROP_ERROR_BUFFER_SIZE;
@@ -336,21 +345,56 @@ int extract_drop_error(struct drop_error_buffer *eb, uint8_t *buf, int buflen)
 }
 int extract_poke(struct poke_buffer *eb, uint8_t *buf, int buflen)
 {
-	if (buflen < (8 + 1) || !eb->occupancy) return -1;
+	if (buflen < (int)sizeof(struct report_poke) || !eb->occupancy) return -1;
 	
-	time_to_wire(eb->stamps[eb->first_real], buf);
-	buf[8] = eb->locs[eb->first_real];
+	pack_poke(buf, host_time(eb->stamps[eb->first_real]), eb->locs[eb->first_real]);
 	eb->occupancy--;
 	eb->first_real++;
 	eb->first_real %= POKE_BUFFER_SIZE;
 	return 0;
 }
+//takes changes off in order until one is for a peg already in the snapshot, that one starts the next
+int extract_peg_snapshot(struct peg_buffer *eb, uint8_t *buf, int buflen)
+{
+	uint8_t state = 0, later = 0, changed = 0, n, ix = eb->first_real;
+	ms_time_t first = eb->stamps[ix], base = first;
+	uint16_t deltas[PEG_COUNT] = {0};
+
+	if (buflen < (int)sizeof(struct report_peg_snapshot) || !eb->occupancy) return -1;
+	
+	for (n = 0; n < eb->occupancy; n++, ix = (ix + 1) % PEG_BUFFER_SIZE) {
+		int32_t d = eb->stamps[ix] - first;
+		if ((changed & (1 << eb->locs[ix])) || d > PEG_SNAPSHOT_SPAN || d < -PEG_SNAPSHOT_SPAN) break;
+		changed |= (1 << eb->locs[ix]);
+		//stamps are onsets, which need not come in the order the changes were confirmed
+		if ((int32_t)(eb->stamps[ix] - base) < 0) base = eb->stamps[ix];
+	}
+	//each peg's state after this snapshot: from before its next change still queued, or else from the peg itself,
+	//so a change dropped when the queue was full does not leave a wrong bit behind
+	for (uint8_t k = n; k < eb->occupancy; k++, ix = (ix + 1) % PEG_BUFFER_SIZE) {
+		uint8_t bit = 1 << eb->locs[ix];
+		if (later & bit) continue;
+		later |= bit;
+		if (!eb->newsts[ix]) state |= bit;
+	}
+	for (uint8_t i = 0; i < PEG_COUNT; i++)
+		if (!(later & (1 << i)) && pegs[i].state == PEG_STATE_CAPPED)
+			state |= (1 << i);
+	for (; n; n--) {
+		uint8_t loc = eb->locs[eb->first_real];
+		deltas[loc] = eb->stamps[eb->first_real] - base;
+		eb->occupancy--;
+		eb->first_real++;
+		eb->first_real %= PEG_BUFFER_SIZE;
+	}
+	pack_peg_snapshot(buf, host_time(base), state, changed, deltas);
+	return 0;
+}
 int extract_tool(struct tool_buffer *eb, uint8_t *buf, int buflen)
 {
-	if (buflen < (8 + 1) || !eb->occupancy) return -1;
+	if (buflen < (int)sizeof(struct report_tool) || !eb->occupancy) return -1;
 	
-	time_to_wire(eb->stamps[eb->first_real], buf);
-	buf[8] = eb->newsts[eb->first_real];
+	pack_tool(buf, host_time(eb->stamps[eb->first_real]), eb->newsts[eb->first_real]);
 	eb->occupancy--;
 	eb->first_real++;
 	eb->first_real %= TOOL_BUFFER_SIZE;
@@ -358,10 +402,9 @@ int extract_tool(struct tool_buffer *eb, uint8_t *buf, int buflen)
 }
 int extract_event(struct event_buffer *eb, unsigned char *buf, int buflen)
 {
-	if (buflen < (8 + 1) || !eb->occupancy) return -1;
+	if (buflen < (int)sizeof(struct report_event) || !eb->occupancy) return -1;
 	
-	time_to_wire(eb->stamps[eb->first_real], buf);
-	buf[8] = eb->typs[eb->first_real];
+	pack_event(buf, host_time(eb->stamps[eb->first_real]), eb->typs[eb->first_real]);
 	eb->occupancy--;
 	eb->first_real++;
 	eb->first_real %= EVENT_BUFFER_SIZE;
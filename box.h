@@ -27,18 +27,37 @@ ms_time_t timeout;
 #define TOOL_ERROR_LINE 9
 #define TOOL_HOLDER_LINE 8
 #define TOOL_CONNECTED_LINE 12
+//name, adc line; each reads high or low through its hysteresis band in settings.tool_thresh, in this order
+#define TOOL_LINES(_) \
+  _(error, TOOL_ERROR_LINE)\
+  _(jack, TOOL_CONNECTED_LINE)\
+  _(holder, TOOL_HOLDER_LINE)
+#define AS_TOOL_LINE_ENUM(name, line) TOOL_LINE_##name,
+enum {TOOL_LINES(AS_TOOL_LINE_ENUM)};
 typedef enum {
 	WALL_ERROR_OK = 0,
 	WALL_ERROR_WRONG = 1,
 	NO_TOOL = 2,
 	TOOL_IN_AND_OK = 3
 } tool_state;
+//a classification has to hold this long (ms) before cur_tool takes it
+#define TOOL_DWELL_TABLE { \
+	[WALL_ERROR_OK] = 20, \
+	[WALL_ERROR_WRONG] = 500, \
+	[NO_TOOL] = 100, \
+	[TOOL_IN_AND_OK] = 20, \
+}
 tool_state cur_tool;
+//how far, in adc counts up to 255, the lines deciding cur_tool are from flipping it
+uint8_t tool_confidence;
 int
 tool_in_slot(void);
 
 //how long must an error be to count as an error against the student?
 uint16_t wall_error_timeout;
+//contacts less than this many ms apart are one error episode
+uint16_t wall_error_merge;
+#define WALL_ERROR_MERGE_DEFAULT 250
 void
 handle_wall_errors(void);
 void
@@ -46,18 +65,9 @@ reset_wall_errors(void);
 
 void
 box_init(void);
-void
-buzzer_init(void);
-void
-buzzer_on(void);
-void
-buzzer_off(void);
 #define MIN_BUZZER_LENGTH 250
-struct led buzzer_as_led;
 
 
-void
-box_flash_handler(void);
 void
 box_test_leds(void);
 void
@@ -76,34 +86,60 @@ uint8_t lms_said_to_end;
 #define LOC_TIMEOUT (-2)
 #define LOC_READY 42
 
-#define WALL_ERROR_BUFFER_SIZE 3
-#define DROP_ERROR_BUFFER_SIZE 2
-#define POKE_BUFFER_SIZE 3
-#define TOOL_BUFFER_SIZE 3
-#define EVENT_BUFFER_SIZE 3
-
-#define RINGBUFFER_INNARDS int first_empty; unsigned int occupancy; int first_real;
+//queue depths, override from the makefile (e.g. -DPOKE_BUFFER_SIZE=16) to trade RAM for burst capacity
+#ifndef WALL_ERROR_BUFFER_SIZE
+#define WALL_ERROR_BUFFER_SIZE 8
+#endif
+#ifndef DROP_ERROR_BUFFER_SIZE
+#define DROP_ERROR_BUFFER_SIZE 4
+#endif
+#ifndef POKE_BUFFER_SIZE
+#define POKE_BUFFER_SIZE 8
+#endif
+#ifndef PEG_BUFFER_SIZE
+#define PEG_BUFFER_SIZE 16
+#endif
+//a snapshot only takes changes this close to its first, which keeps its deltas in 16 bits
+#define PEG_SNAPSHOT_SPAN 30000
+#ifndef TOOL_BUFFER_SIZE
+#define TOOL_BUFFER_SIZE 8
+#endif
+#ifndef EVENT_BUFFER_SIZE
+#define EVENT_BUFFER_SIZE 4
+#endif
+
+//stamps are device millis, converted with host_time() when extracted so that a resync rebases anything still queued
+#define RINGBUFFER_INNARDS uint8_t first_empty; uint8_t occupancy; uint8_t first_real;
 struct wall_error_buffer {
-	uint64_t stamps[WALL_ERROR_BUFFER_SIZE];
+	ms_time_t stamps[WALL_ERROR_BUFFER_SIZE];
 	uint32_t durs[WALL_ERROR_BUFFER_SIZE];
+	uint16_t gaps[WALL_ERROR_BUFFER_SIZE];
+	uint8_t contacts[WALL_ERROR_BUFFER_SIZE];
 	RINGBUFFER_INNARDS;
 };
 struct drop_error_buffer {
-	uint64_t stamps[DROP_ERROR_BUFFER_SIZE];
+	ms_time_t stamps[DROP_ERROR_BUFFER_SIZE];
 	RINGBUFFER_INNARDS;
 };
 struct poke_buffer {
-	uint64_t stamps[POKE_BUFFER_SIZE];
+	ms_time_t stamps[POKE_BUFFER_SIZE];
 	uint8_t locs[POKE_BUFFER_SIZE];
 	RINGBUFFER_INNARDS;
 };
+struct peg_buffer {
+	ms_time_t stamps[PEG_BUFFER_SIZE]; // onsets
+	ms_time_t queued[PEG_BUFFER_SIZE]; // when the change was confirmed
+	uint8_t locs[PEG_BUFFER_SIZE];
+	uint8_t newsts[PEG_BUFFER_SIZE];
+	RINGBUFFER_INNARDS;
+};
 struct tool_buffer {
-	uint64_t stamps[TOOL_BUFFER_SIZE];
+	ms_time_t stamps[TOOL_BUFFER_SIZE];
 	uint8_t newsts[TOOL_BUFFER_SIZE];
 	RINGBUFFER_INNARDS;
 };
 struct event_buffer {
-	uint64_t stamps[EVENT_BUFFER_SIZE];
+	ms_time_t stamps[EVENT_BUFFER_SIZE];
 	uint8_t typs[EVENT_BUFFER_SIZE];
 	RINGBUFFER_INNARDS;
 };
@@ -111,16 +147,19 @@ struct event_buffer {
 struct wall_error_buffer werrbuf;
 struct drop_error_buffer derrbuf;
 struct poke_buffer pokebuf;
+struct peg_buffer pegbuf;
 struct tool_buffer toolbuf;
 struct event_buffer evtbuf;
 
-void new_wall_error(struct wall_error_buffer *we, uint64_t, ms_time_t);
-void new_drop_error(struct drop_error_buffer *de, uint64_t);
-void new_poke(struct poke_buffer *pb, uint64_t, uint8_t);
-void new_tool(struct tool_buffer *tb, uint64_t, uint8_t);
-void new_event(struct event_buffer *eb, uint64_t, uint8_t);
+void new_wall_error(struct wall_error_buffer *we, ms_time_t, ms_time_t, uint8_t, uint16_t);
+void new_drop_error(struct drop_error_buffer *de, ms_time_t);
+void new_poke(struct poke_buffer *pb, ms_time_t, uint8_t);
+void new_peg(struct peg_buffer *pb, ms_time_t, uint8_t, uint8_t);
+void new_tool(struct tool_buffer *tb, ms_time_t, uint8_t);
+void new_event(struct event_buffer *eb, ms_time_t, uint8_t);
 int extract_wall_error(struct wall_error_buffer *eb, uint8_t *buf, int buflen);
 int extract_drop_error(struct drop_error_buffer *eb, uint8_t *buf, int buflen);
 int extract_poke(struct poke_buffer *eb, uint8_t *buf, int buflen);
+int extract_peg_snapshot(struct peg_buffer *eb, uint8_t *buf, int buflen);
 int extract_tool(struct tool_buffer *eb, uint8_t *buf, int buflen);
 int extract_event(struct event_buffer *eb, uint8_t *buf, int buflen);
@@ -0,0 +1,131 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include "Timer.h"
+#include "contact.h"
+#include "reports.h"
+
+_Static_assert((CONTACT_QUEUE_SIZE & (CONTACT_QUEUE_SIZE - 1)) == 0, "contact queue size must be a power of two");
+
+static struct contact_edge queue[CONTACT_QUEUE_SIZE];
+static volatile uint8_t head; // written only by the interrupt
+static volatile uint8_t tail; // written only by the main loop
+static uint8_t level;
+static ms_time_t level_stamp;
+static volatile uint8_t armed;
+
+//from interrupts only
+static void
+contact_edge(uint8_t l, ms_time_t now)
+{
+	uint8_t h = head;
+
+	if (l == level || now - level_stamp < CONTACT_HOLDOFF_MS || (uint8_t)(h - tail) == CONTACT_QUEUE_SIZE) return;
+	queue[h % CONTACT_QUEUE_SIZE].stamp = now;
+	queue[h % CONTACT_QUEUE_SIZE].level = l;
+	head = h + 1;
+	level = l;
+	level_stamp = now;
+}
+
+//touching the wall pulls the line low, under the reference
+static uint8_t
+ac_contact(void)
+{
+	return !!(ACSR & (1<<ACO));
+}
+
+//from the millis interrupt; while an ADC sweep has the mux the last comparator level stands
+void
+contact_sample(ms_time_t now)
+{
+	if (armed)
+		contact_edge(ac_contact(), now);
+}
+
+ISR(ANALOG_COMP_vect)
+{
+	contact_edge(ac_contact(), millis());
+}
+
+/* Gives the ADC mux to the comparator, at the end of an ADC sweep. */
+void
+contact_ac_arm(void)
+{
+	ADCSRA &= ~(1<<ADEN);
+	if (CONTACT_ADC & 0x08)
+		ADCSRB |= (1<<MUX5);
+	else
+		ADCSRB &= ~(1<<MUX5);
+	ADMUX = (ADMUX & 0xe0) | (CONTACT_ADC & 0x07);
+	ADCSRB |= (1<<ACME);
+	//any edge, flag cleared before the interrupt is enabled so an old crossing does not fire it
+	ACSR = (CONTACT_REF == CONTACT_REF_BANDGAP ? (1<<ACBG) : 0) | (1<<ACI);
+	ACSR |= (1<<ACIE);
+	armed = 1;
+}
+
+/* Takes the mux back for the ADC. */
+void
+contact_ac_disarm(void)
+{
+	ACSR &= ~(1<<ACIE);
+	armed = 0;
+	ADCSRB &= ~(1<<ACME);
+	ADCSRA |= (1<<ADEN);
+}
+
+bool
+contact_pop(struct contact_edge *e)
+{
+	uint8_t t = tail;
+
+	if (t == head) return false;
+	*e = queue[t % CONTACT_QUEUE_SIZE];
+	tail = t + 1;
+	return true;
+}
+
+void
+contact_flush(void)
+{
+	tail = head;
+}
+
+/* Aggregates over every wall contact since the last clear, so the host can poll one report instead of replaying
+ * every wall_error. */
+static struct {
+	uint16_t count;
+	uint32_t total;
+	uint16_t hist[CONTACT_BUCKETS];
+	uint32_t longest;
+} metrics;
+
+void
+contact_metrics_note(ms_time_t dur)
+{
+	uint8_t b = 0;
+
+	for (ms_time_t d = dur >> 1; d && b < CONTACT_BUCKETS-1; d >>= 1)
+		b++;
+	if (metrics.hist[b] < UINT16_MAX)
+		metrics.hist[b]++;
+	if (metrics.count < UINT16_MAX)
+		metrics.count++;
+	metrics.total += dur;
+	if (dur > metrics.longest)
+		metrics.longest = dur;
+}
+
+uint8_t
+contact_metrics(uint8_t *Data)
+{
+	pack_contact_metrics(Data, metrics.count, metrics.total, metrics.hist, metrics.longest);
+	return sizeof(struct report_contact_metrics);
+}
+
+void
+contact_metrics_clear(void)
+{
+	memset(&metrics, 0, sizeof(metrics));
+}
@@ -0,0 +1,70 @@
+#ifndef _CONTACT_H_
+#define _CONTACT_H_
+	#include <stdint.h>
+	#include <stdbool.h>
+	#include "Timer.h"
+
+	/* Wall contact edges, queued with their millis() stamp for the main loop to drain, so contact start and end are
+	 * exact to the millisecond whatever the loop period.
+	 *
+	 * The wall error line (PD6, ADC9) has no pin change or external interrupt on this chip. Between ADC sweeps the
+	 * analog comparator watches it through the ADC mux against CONTACT_REF and interrupts on every crossing. The
+	 * comparator can only use the mux while the ADC is off, so adc_sweep() takes it back for each sweep and hands it
+	 * over again afterwards; meanwhile the level from before the sweep stands, and a change during it is seen when
+	 * the comparator is armed again. A sweep is 13 conversions at the clk/128 ADC clock, 13 cycles each and 25 for
+	 * the first after the ADC is enabled, so the line is unwatched for about 1.45 ms (ADC_SWEEP_US) once every
+	 * ADC_SWEEP_MS: an edge in it is stamped up to that late and a touch shorter than that lying wholly in it is
+	 * lost. That bound is worked out from the datasheet timings, not measured on a board. The 1 ms millis interrupt also samples the comparator
+	 * output while armed, so a crossing the interrupt skipped is still picked up on the next tick. Only the comparator
+	 * decides contact, so a line resting near a threshold cannot flip with every sweep.
+	 *
+	 * The reference is the bandgap, 1.1 V, not the 2.5 V the ADC used to split contact at: no internal reference is
+	 * near 2.5 V and AIN0 is a target LED on Pokey. The idle line is pulled up to Vcc and a wall contact shorts it to
+	 * ground, so both sit far from either level and 1.1 V only leaves out partial contacts of 1.1-2.5 V.
+	 *
+	 * A change within CONTACT_HOLDOFF_MS of the last queued edge waits until the hold-off is over, which is the
+	 * hysteresis: chatter faster than that is seen as the level it settles to.
+	 *
+	 * The queue has one producer (the interrupt) and one consumer (the main loop), each owning one 8 bit index, so
+	 * neither side needs to block interrupts. When it is full the interrupt holds the edge back and retries it on the
+	 * next tick, so levels in the queue always alternate.
+	 */
+	#define CONTACT_ADC 9 // TOOL_ERROR_LINE
+	#define ADC_SWEEP_US (128UL * (25 + 12 * 13) * 1000000UL / F_CPU)
+
+	#define CONTACT_REF_BANDGAP 0 // internal 1.1 V
+	#define CONTACT_REF_AIN0 1 // external divider on PE6, which is a target LED on Pokey
+	#ifndef CONTACT_REF
+	#define CONTACT_REF CONTACT_REF_BANDGAP
+	#endif
+	#ifndef CONTACT_HOLDOFF_MS
+	#define CONTACT_HOLDOFF_MS 2
+	#endif
+	#define CONTACT_QUEUE_SIZE 8 // power of two
+
+	struct contact_edge {
+		ms_time_t stamp;
+		uint8_t level; // 1 at the start of a contact, 0 at its end
+	};
+
+	void
+	contact_sample(ms_time_t now);
+	void
+	contact_ac_arm(void);
+	void
+	contact_ac_disarm(void);
+	bool
+	contact_pop(struct contact_edge *e);
+	void
+	contact_flush(void);
+
+	// log2 buckets of contact duration: 0-1, 2-3, 4-7, ... 1024-2047, 2048+ ms
+	#define CONTACT_BUCKETS 12
+
+	void
+	contact_metrics_note(ms_time_t dur);
+	uint8_t
+	contact_metrics(uint8_t *Data);
+	void
+	contact_metrics_clear(void);
+#endif
@@ -0,0 +1,58 @@
+#include <avr/pgmspace.h>
+#include "Timer.h"
+#include "debounce.h"
+
+#define AS_DB_CLASS_PERIOD(name, period) period,
+static const uint16_t class_period[DB_CLASS_COUNT] PROGMEM = {DEBOUNCE_CLASSES(AS_DB_CLASS_PERIOD)};
+
+#define AS_DB_CLASS_BIT(want, name, cls) | (DB_CLASS_##cls == (want) ? DB_BIT(DB_##name) : 0)
+#define AS_DB_CLASS_MASK(name, period) (0 DEBOUNCE_INPUTS(AS_DB_CLASS_BIT, DB_CLASS_##name)),
+static const uint32_t class_mask[DB_CLASS_COUNT] PROGMEM = {DEBOUNCE_CLASSES(AS_DB_CLASS_MASK)};
+
+#define AS_DB_INPUT_CLASS(x, name, cls) DB_CLASS_##cls,
+static const uint8_t input_class[DB_COUNT] PROGMEM = {DEBOUNCE_INPUTS(AS_DB_INPUT_CLASS, )};
+
+static uint16_t class_last[DB_CLASS_COUNT];
+//the vertical counter, bit n of cnt1:cnt0 counts the samples in a row where input n differed
+static uint32_t cnt0, cnt1;
+
+/* Sets an input's raw and debounced level at once, for inputs whose start state should not be reported. */
+void
+debounce_preset(uint8_t input, uint8_t level)
+{
+	debounce_put(input, level);
+	if (level)
+		db_state |= DB_BIT(input);
+	else
+		db_state &= ~DB_BIT(input);
+	cnt0 &= ~DB_BIT(input);
+	cnt1 &= ~DB_BIT(input);
+}
+
+void
+debounce_tick(ms_time_t now)
+{
+	uint32_t en = 0;
+
+	for (uint8_t c = 0; c < DB_CLASS_COUNT; c++) {
+		if ((uint16_t)((uint16_t)now - class_last[c]) >= pgm_read_word(&class_period[c])) {
+			class_last[c] = now;
+			en |= pgm_read_dword(&class_mask[c]);
+		}
+	}
+
+	//inputs not sampled this tick keep their count
+	uint32_t delta = (db_raw ^ db_state) & en;
+	cnt1 = ((cnt1 ^ cnt0) & delta) | (cnt1 & ~en);
+	cnt0 = (~cnt0 & delta) | (cnt0 & ~en);
+	db_changed = delta & ~(cnt0 | cnt1);
+	db_state ^= db_changed;
+}
+
+/* When an input that just flipped most likely really changed: the first of its DEBOUNCE_SAMPLES differing samples. */
+ms_time_t
+debounce_onset(uint8_t input, ms_time_t now)
+{
+	uint8_t c = pgm_read_byte(&input_class[input]);
+	return now - (ms_time_t)(DEBOUNCE_SAMPLES-1) * pgm_read_word(&class_period[c]);
+}
@@ -0,0 +1,91 @@
+#ifndef _DEBOUNCE_H_
+#define _DEBOUNCE_H_
+	#include <stdint.h>
+	#include "Timer.h"
+
+	/* Debounced inputs, one bit each in a packed bitmap. Modules write the raw level with debounce_put() whenever
+	 * they read it, debounce_tick() runs once per main loop pass and updates db_state and db_changed for everyone.
+	 *
+	 * Class:  _(name, sample period in ms)
+	 * Input:  _(name, class)
+	 *
+	 * Each bit has a two-bit vertical counter: an input flips after DEBOUNCE_SAMPLES samples in a row that differ from
+	 * its debounced level, and samples are taken at its class period. So the latency of every input in a class is the
+	 * same and bounded, DEBOUNCE_SAMPLES-1 to DEBOUNCE_SAMPLES periods after the real change.
+	 */
+	#define DEBOUNCE_CLASSES(_) \
+		_(tool,   50) \
+		_(peg,    250) \
+		_(button, 2)
+
+	#define DEBOUNCE_INPUTS(_, ...) \
+		_(__VA_ARGS__, tool_in,   tool) \
+		_(__VA_ARGS__, tool_gone, tool) \
+		_(__VA_ARGS__, peg0,      peg) \
+		_(__VA_ARGS__, peg1,      peg) \
+		_(__VA_ARGS__, peg2,      peg) \
+		_(__VA_ARGS__, peg3,      peg) \
+		_(__VA_ARGS__, peg4,      peg) \
+		_(__VA_ARGS__, peg5,      peg) \
+		_(__VA_ARGS__, button0,   button) \
+		_(__VA_ARGS__, button1,   button) \
+		_(__VA_ARGS__, button2,   button) \
+		_(__VA_ARGS__, button3,   button) \
+		_(__VA_ARGS__, button4,   button) \
+		_(__VA_ARGS__, button5,   button) \
+		_(__VA_ARGS__, button6,   button) \
+		_(__VA_ARGS__, button7,   button) \
+		_(__VA_ARGS__, button8,   button) \
+		_(__VA_ARGS__, button9,   button)
+
+	#define DEBOUNCE_SAMPLES 4
+
+	#define AS_DB_CLASS_ENUM(name, period) DB_CLASS_##name,
+	enum debounce_class {
+		DEBOUNCE_CLASSES(AS_DB_CLASS_ENUM)
+		DB_CLASS_COUNT
+	};
+	#define AS_DB_ENUM(x, name, cls) DB_##name,
+	enum debounce_input {
+		DEBOUNCE_INPUTS(AS_DB_ENUM, )
+		DB_COUNT
+	};
+	_Static_assert(DB_COUNT <= 32, "debounced inputs are packed in 32 bits");
+
+	#define DB_BIT(input) ((uint32_t)1 << (input))
+
+	uint32_t db_raw;
+	uint32_t db_state;
+	// inputs that flipped on the last tick
+	uint32_t db_changed;
+
+	static inline void
+	debounce_put(uint8_t input, uint8_t level)
+	{
+		if (level)
+			db_raw |= DB_BIT(input);
+		else
+			db_raw &= ~DB_BIT(input);
+	}
+
+	// n inputs from first on, bit 0 of bits is input first
+	static inline void
+	debounce_put_bits(uint8_t first, uint8_t n, uint32_t bits)
+	{
+		uint32_t mask = (DB_BIT(n) - 1) << first;
+		db_raw = (db_raw & ~mask) | ((bits << first) & mask);
+	}
+
+	static inline uint8_t
+	debounced(uint8_t input)
+	{
+		return !!(db_state & DB_BIT(input));
+	}
+
+	void
+	debounce_preset(uint8_t input, uint8_t level);
+	void
+	debounce_tick(ms_time_t now);
+	ms_time_t
+	debounce_onset(uint8_t input, ms_time_t now);
+#endif
@@ -1,59 +1,217 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <util/atomic.h>
 #include "Timer.h"
 #include "led.h"
 
-void do_flashing(struct led *l, ms_time_t now)
-{
-	if (!l->currently_flashing) return;
-	//if times == -1 flash forever
-	ms_time_t elapsed = now - l->cur_flash_start;
-	if (l->cur_flash_mode == 1) {
-		if (elapsed > l->flash_on_dur) {
-			l->off();
-			l->cur_flash_mode = 0;
-			//it is true that we could do some special compensation for elapsed time but it would only be noticeable if you were looking on an oscope.
-			l->cur_flash_start = now;
-		} //else nothing, things are fine
-	} else {
-		if (elapsed > l->flash_off_dur) {
-			l->flashes_done++;
-			if (l->times_to_flash == -1 || l->flashes_done < l->times_to_flash) {
-				//flash more
-				l->on();
-				l->cur_flash_mode = 1;
-				l->cur_flash_start = now;
-			} else {
-				//stop flashing
-				l->currently_flashing = 0;
-				//it's already off
+static struct led *led_list[LED_MAX];
+static uint8_t led_count;
+
+/* Per port: the register, the bits the engine owns in it, and what those bits are during each bit slot of a frame. */
+static volatile uint8_t *led_ports[LED_PORTS];
+static uint8_t led_port_mask[LED_PORTS];
+static uint8_t led_port_count;
+static uint8_t led_planes[LED_LEVEL_BITS][LED_PORTS];
+static uint8_t bcm_bit;
+
+//scanned LEDs that are held dark in each scan phase
+static uint8_t led_scan_off[LED_SCAN_PHASES][LED_PORTS];
+static uint8_t led_scan_count;
+static uint8_t led_scan_phase;
+
+//callers outside the interrupt hold interrupts off
+static void
+put_level(struct led *l, uint8_t level)
+{
+	uint8_t mask = pgm_read_byte(&l->pin->mask);
+	uint8_t *plane = &led_planes[0][l->port_ix];
+
+	l->level = level;
+	for (uint8_t k = 0; k < LED_LEVEL_BITS; k++, plane += LED_PORTS, level >>= 1) {
+		if (level & 1)
+			*plane |= mask;
+		else
+			*plane &= ~mask;
+	}
+}
+
+static void
+led_step(struct led *l)
+{
+	switch (l->anim) {
+	case LED_ANIM_FLASH_ON:
+		put_level(l, 0);
+		l->anim = LED_ANIM_FLASH_OFF;
+		l->anim_left = l->flash_off_dur;
+		break;
+	case LED_ANIM_FLASH_OFF:
+		l->flashes_done++;
+		if (l->times_to_flash == LED_FLASH_FOREVER || l->flashes_done < l->times_to_flash) {
+			put_level(l, l->bright);
+			l->anim = LED_ANIM_FLASH_ON;
+			l->anim_left = l->flash_on_dur;
+		} else {
+			//stop flashing, it's already off
+			l->anim = LED_ANIM_NONE;
+		}
+		break;
+	case LED_ANIM_FADE:
+		put_level(l, l->level < l->fade_to ? l->level + 1 : l->level - 1);
+		if (l->level == l->fade_to)
+			l->anim = LED_ANIM_NONE;
+		else
+			l->anim_left = l->fade_step;
+		break;
+	}
+}
+
+static void
+led_animate(void)
+{
+	for (uint8_t i = 0; i < led_count; i++) {
+		struct led *l = led_list[i];
+		if (l->anim == LED_ANIM_NONE) continue;
+		if (l->anim_left > LED_TICK_MS)
+			l->anim_left -= LED_TICK_MS;
+		else
+			led_step(l);
+	}
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+	uint8_t k = bcm_bit;
+	const uint8_t *off = led_scan_off[led_scan_phase];
+
+	for (uint8_t i = 0; i < led_port_count; i++)
+		*led_ports[i] = (*led_ports[i] & ~led_port_mask[i]) | (led_planes[k][i] & ~off[i]);
+	//CTC has just cleared the counter, so this sets how long bit k is shown
+	OCR3A = (LED_BCM_UNIT << k) - 1;
+	if (++k == LED_LEVEL_BITS) {
+		k = 0;
+		if (++led_scan_phase == LED_SCAN_PHASES)
+			led_scan_phase = 0;
+		led_animate();
+	}
+	bcm_bit = k;
+}
+
+void
+led_init(void)
+{
+	TCCR3A = 0;
+	TCCR3B = (1<<WGM32)|(1<<CS31); // CTC on OCR3A, clk/8
+	OCR3A = LED_BCM_UNIT - 1;
+	TIMSK3 |= (1<<OCIE3A);
+}
+
+/* Hands the pin over to the engine, which from then on rewrites it every bit slot. Starts off at full brightness. */
+void
+led_register(struct led *l)
+{
+	volatile uint8_t *port = pgm_read_ptr(&l->pin->port);
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i = 0; i < led_port_count && led_ports[i] != port; i++);
+		if (led_count < LED_MAX && i < LED_PORTS) {
+			if (i == led_port_count) {
+				led_ports[i] = port;
+				led_port_count++;
 			}
+			l->port_ix = i;
+			l->bright = LED_LEVEL_MAX;
+			l->anim = LED_ANIM_NONE;
+			put_level(l, 0);
+			led_port_mask[i] |= pgm_read_byte(&l->pin->mask);
+			led_list[led_count++] = l;
 		}
 	}
 }
 
-/*
-void flash_handler(void)
+/* As led_register(), but the LED only lights during its scan phase. It looks lit for the whole time at 1/LED_SCAN_PHASES
+ * of the current, which is what lets every Pokey target be on at once. */
+void
+led_register_scanned(struct led *l)
 {
-	ms_time_t now = millis();
-	FOREACH_LED(l) do_flashing(l, now); 
+	uint8_t n = led_count;
+
+	led_register(l);
+	if (led_count == n) return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t phase = led_scan_count++ % LED_SCAN_PHASES;
+		for (uint8_t p = 0; p < LED_SCAN_PHASES; p++)
+			if (p != phase)
+				led_scan_off[p][l->port_ix] |= pgm_read_byte(&l->pin->mask);
+	}
 }
-*/
 
-void start_flashing(struct led *l, int times, int on_dur, int off_dur)
+void
+led_set_level(struct led *l, uint8_t level)
 {
-	l->times_to_flash = times;
-	l->flash_on_dur = on_dur;
-	l->flash_off_dur = off_dur;
-	l->currently_flashing = 1;
-	l->flashes_done = 0;
-	l->cur_flash_mode = 1;
-	l->cur_flash_start = millis();
-	l->on();
+	if (level > LED_LEVEL_MAX) level = LED_LEVEL_MAX;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		l->anim = LED_ANIM_NONE;
+		put_level(l, level);
+	}
+}
+
+void
+led_set_brightness(struct led *l, uint8_t bright)
+{
+	if (bright > LED_LEVEL_MAX) bright = LED_LEVEL_MAX;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		//a steady on LED follows right away, a flash picks it up at its next on
+		if (l->anim == LED_ANIM_NONE && l->level == l->bright)
+			put_level(l, bright);
+		l->bright = bright;
+	}
+}
+
+void
+led_turn_on(struct led *l)
+{
+	led_set_level(l, l->bright);
+}
+
+void
+led_turn_off(struct led *l)
+{
+	led_set_level(l, 0);
+}
+
+/* Moves the brightness one level at a time from where it is to "to", taking about dur ms in all. */
+void
+led_fade(struct led *l, uint8_t to, uint16_t dur)
+{
+	if (to > LED_LEVEL_MAX) to = LED_LEVEL_MAX;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t steps = abs((int8_t)to - (int8_t)l->level);
+		if (steps) {
+			l->fade_to = to;
+			l->fade_step = dur / steps;
+			l->anim_left = 0;
+			l->anim = LED_ANIM_FADE;
+		} else {
+			l->anim = LED_ANIM_NONE;
+		}
+	}
+}
+
+void start_flashing(struct led *l, uint8_t times, uint16_t on_dur, uint16_t off_dur)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		l->times_to_flash = times;
+		l->flash_on_dur = on_dur;
+		l->flash_off_dur = off_dur;
+		l->flashes_done = 0;
+		l->anim_left = on_dur;
+		l->anim = LED_ANIM_FLASH_ON;
+		put_level(l, l->bright);
+	}
 }
 
 void stop_flashing(struct led *l)
 {
-	l->currently_flashing = 0;
-	l->off();
-}
\ No newline at end of file
+	led_turn_off(l);
+}
@@ -1,23 +1,87 @@
+#ifndef _LED_H_
+#define _LED_H_
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "Timer.h"
+
+/* An output driven by the led engine: its register and the bits to set for on, kept in flash. */
+struct led_pin {
+	volatile uint8_t *port;
+	uint8_t mask;
+};
+#define AS_LED_PIN(name, port, ddr, num) \
+	static const struct led_pin led_pin_ ## name PROGMEM = {&(port), (1<<(num))};
+#define AS_ENABLE_OUTPUT(name, port, ddr, num) ddr |= (1<<num);
+
+/* The led engine owns every registered pin. Timer3 runs binary code modulation: one interrupt per brightness bit, bit
+ * k held for LED_BCM_UNIT<<k timer counts, so a whole frame of LED_LEVEL_BITS interrupts lasts LED_TICK_MS and writes
+ * each port once per interrupt. Flashes and fades advance once per frame in the same interrupt, nothing needs to be
+ * polled from the main loop and the functions below only change what the interrupt will do. */
+#define LED_LEVEL_BITS 5
+#define LED_LEVEL_MAX ((1<<LED_LEVEL_BITS)-1)
+#define LED_BCM_UNIT 128 // timer counts at clk/8, 64 us, so a frame is 31*64 us
+#define LED_TICK_MS 2
+#define LED_MAX 16
+#define LED_PORTS 6
+/* LEDs registered with led_register_scanned() are split round robin over this many frames and only light in their
+ * own, so at most 1/LED_SCAN_PHASES of them draw current at any instant. */
+#define LED_SCAN_PHASES 2
+
+#define LED_ANIM_NONE 0
+#define LED_ANIM_FLASH_ON 1
+#define LED_ANIM_FLASH_OFF 2
+#define LED_ANIM_FADE 3
+
 struct led {
-	void (*on)(void);
-	void (*off)(void);
-	
-	/* flashing, all centralized */
-	//waveform of a flash /^^^^^^^\___
-	int currently_flashing;
-	int flashes_done; // incremented at end of off portion
-	ms_time_t cur_flash_start;
-	int cur_flash_mode;
-	unsigned int flash_on_dur;
-	unsigned int flash_off_dur;
-	int times_to_flash;
+	const struct led_pin *pin;
+	uint8_t port_ix; // slot in the engine's port list, set by led_register()
+	uint8_t level; // brightness right now, 0..LED_LEVEL_MAX
+	uint8_t bright; // brightness for on and for the on part of a flash
+	uint8_t anim; // LED_ANIM_*
+	uint16_t anim_left; // ms to the next animation step
+	union {
+		//waveform of a flash /^^^^^^^\___
+		struct {
+			uint16_t flash_on_dur;
+			uint16_t flash_off_dur;
+			uint8_t times_to_flash; // LED_FLASH_FOREVER or a count
+			uint8_t flashes_done; // incremented at end of off portion
+		};
+		struct {
+			uint16_t fade_step; // ms per level
+			uint8_t fade_to;
+		};
+	};
 };
+#define LED_FLASH_FOREVER 0xff
+
+void
+led_init(void);
+
+void
+led_register(struct led *l);
+
+void
+led_register_scanned(struct led *l);
+
+void
+led_set_level(struct led *l, uint8_t level);
+
+void
+led_set_brightness(struct led *l, uint8_t bright);
+
+void
+led_turn_on(struct led *l);
+
+void
+led_turn_off(struct led *l);
 
 void
-do_flashing(struct led *l, ms_time_t now);
+led_fade(struct led *l, uint8_t to, uint16_t dur);
 
 void
-start_flashing(struct led *l, int times, int on_dur, int off_dur);
+start_flashing(struct led *l, uint8_t times, uint16_t on_dur, uint16_t off_dur);
 
 void
 stop_flashing(struct led *l);
+#endif
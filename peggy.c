@@ -1,9 +1,15 @@
+#include <stdlib.h>
+#include <string.h>
 #include "Timer.h"
 #include "led.h"
 #include "box.h"
 #include "adc.h"
 #include "peggy.h"
-#include <avr/eeprom.h>
+#include "session_log.h"
+#include "settings.h"
+#include "sound.h"
+#include "debounce.h"
+#include "reports.h"
 
 //each peg keeps track of its own state from the states UP, DOWN, RISING, FALLING
 //RISING means was stable DOWN, changed
@@ -12,69 +18,94 @@
 #define FOREACH_PEG(k) for (struct peg *k = &pegs[0];k < &pegs[6];k++)
 #define FOREACH_LEFT_PEG(k) for (struct peg *k = &pegs[0];k < &pegs[3];k++)
 #define FOREACH_RIGHT_PEG(k) for (struct peg *k = &pegs[3];k < &pegs[6];k++)
-#define PEG_DELAY 1000
 
 #define PEG_MESSAGE_CAPPED 1
 #define PEG_MESSAGE_CLEAR 0
 
+static void
+peg_track(struct peg *p, uint16_t v, ms_time_t now)
+{
+	//only while steady: the reading agrees with the debounced state
+	if (!p->state || debounced(DB_peg0 + p->loc) != (v < p->thresh)) return;
+	if (now - p->tracked < PEG_TRACK_MS) return;
+	p->tracked = now;
+
+	uint8_t seen = p->state == PEG_STATE_CAPPED ? PEG_SEEN_COVERED : PEG_SEEN_OPEN;
+	uint16_t *lvl = p->state == PEG_STATE_CAPPED ? &p->covered_lvl : &p->open_lvl;
+	int16_t x = v << PEG_TRACK_FRAC;
+	//rounded to nearest, a plain shift would floor and pull every baseline low under noise
+	if (p->seen & seen)
+		*lvl += (x - (int16_t)*lvl + (1 << (PEG_TRACK_SHIFT-1))) >> PEG_TRACK_SHIFT;
+	else
+		*lvl = x;
+	p->seen |= seen;
+
+	if (p->seen != (PEG_SEEN_OPEN|PEG_SEEN_COVERED)) return;
+	uint16_t open = p->open_lvl >> PEG_TRACK_FRAC;
+	uint16_t covered = p->covered_lvl >> PEG_TRACK_FRAC;
+	if (open < covered + PEG_MIN_SPAN) return;
+	int16_t t = (open + 4*covered) / 5;
+	int16_t base = settings.peg_thresh[p->loc];
+	if (t > base + PEG_DRIFT_MAX) t = base + PEG_DRIFT_MAX;
+	if (t < base - PEG_DRIFT_MAX) t = base - PEG_DRIFT_MAX;
+	if (abs(t - (int16_t)p->thresh) >= PEG_RETUNE_HYST)
+		p->thresh = t;
+}
+
+//true once the readings since the sum last left 0 are strong evidence that the peg changed state
+static uint8_t
+peg_cusum(struct peg *p, uint16_t v, ms_time_t now)
+{
+	if (!p->state || now - p->cusum_at < PEG_CUSUM_MS) return 0;
+	p->cusum_at = now;
+
+	int16_t d = p->state == PEG_STATE_CAPPED ? (int16_t)v - (int16_t)p->thresh : (int16_t)p->thresh - (int16_t)v;
+	if (d > PEG_CUSUM_CLAMP) d = PEG_CUSUM_CLAMP;
+	int16_t s = p->cusum + d - PEG_CUSUM_K;
+	if (s <= 0) {
+		p->cusum = 0;
+		return 0;
+	}
+	if (!p->cusum) p->cusum_start = now;
+	p->cusum = s;
+	return s >= PEG_CUSUM_H;
+}
+
 void
-peg_tick(struct peg *p)
+peg_tick(struct peg *p, ms_time_t now)
 {
-	// TODO if a peg is down, but then determined to be up, and the down message isn't sent yet or something, the up message will be discarded by the buffer and will not make it to the host.
-	//determine that it isn't just thresholds or something
-	//combined
-	int covered = adc_values[p->adc_ix] < p->thresh;
-	if (covered) {
-		switch(p->state) {
-		case PEG_STATE_CAPPED:
-			//still capped, everything is great.
-			break;
-		case PEG_STATE_CAPPING:
-			if ((millis() - p->state_start) > PEG_DELAY) {
-				//new_peg(&pegbuf, host_millis(), p->loc, PEG_MESSAGE_CAPPED);
-				//set values so that message will be sent elsewhere
-				peg_stamps[p->loc] = host_millis();
-				peg_msg_pending |= (1 << p->loc);
-				peg_msg_state |= (1 << p->loc);
-				p->state = PEG_STATE_CAPPED;
-				p->state_start = millis();
-			}
-			break;
-		case PEG_STATE_CLEARING:
-		case PEG_STATE_CLEAR:
-		default:
-			p->state = PEG_STATE_CAPPING;
-			p->state_start = millis();
-		
-		}
+	uint8_t input = DB_peg0 + p->loc;
+	uint16_t v = adc_values[p->adc_ix];
+	ms_time_t onset;
+	debounce_put(input, v < p->thresh);
+	if (!p->state) {
+		//the first reading is taken as it is, the status report carries it to the host
+		debounce_preset(input, v < p->thresh);
+		p->state = v < p->thresh ? PEG_STATE_CAPPED : PEG_STATE_CLEAR;
+		return;
+	}
+	peg_track(p, v, now);
+	if (peg_cusum(p, v, now)) {
+		//the debouncer would get there too, later, so settle it now
+		onset = p->cusum_start;
+		debounce_preset(input, p->state != PEG_STATE_CAPPED);
+	} else if (debounced(input) != (p->state == PEG_STATE_CAPPED)) {
+		//compared with the state, not db_changed, so a flip on a pass that skipped the pegs is still seen
+		onset = debounce_onset(input, now);
 	} else {
-		switch(p->state) {
-		case PEG_STATE_CLEAR:
-			//still clear, everything is great.
-			break;
-		case PEG_STATE_CLEARING:
-			if ((millis() - p->state_start) > PEG_DELAY) {
-				//new_peg(&pegbuf, host_millis(), p->loc, PEG_MESSAGE_CLEAR);
-				peg_stamps[p->loc] = host_millis();
-				peg_msg_pending |= (1 << p->loc);
-				peg_msg_state &= ~(1 << p->loc);
-				p->state = PEG_STATE_CLEAR;
-				p->state_start = millis();
-			}
-			break;
-		case PEG_STATE_CAPPING:
-		case PEG_STATE_CAPPED:
-		default:
-			p->state = PEG_STATE_CLEARING;
-			p->state_start = millis();
-		
-		}
+		return;
 	}
+	p->cusum = 0;
+
+	p->state = debounced(input) ? PEG_STATE_CAPPED : PEG_STATE_CLEAR;
+	//queued in order, a cap and a quick clear after it both reach the host
+	new_peg(&pegbuf, onset, p->loc, p->state == PEG_STATE_CAPPED ? PEG_MESSAGE_CAPPED : PEG_MESSAGE_CLEAR);
 }
 void
 handle_pegs(void)
 {
-	FOREACH_PEG(p) peg_tick(p);
+	ms_time_t now = millis();
+	FOREACH_PEG(p) peg_tick(p, now);
 }
 
 #define AS_DECLARE_HARDWARE(name, port, ddr, pin, num, loc) ddr &= ~(1<<pin);
@@ -85,36 +116,210 @@ peggy_hardware(void)
 	PEG_TABLE(AS_DECLARE_HARDWARE);
 }
 
-#define PEGGY_THRESHOLD 512
-#define AS_PEGS(name, port, ddr, pin, num, locc) {.adc_ix = num, .thresh = PEGGY_THRESHOLD, .loc=locc},
+#define AS_PEGS(name, port, ddr, pin, num, locc) {.adc_ix = num, .loc=locc},
 
 struct peg pegs[PEG_COUNT] = {PEG_TABLE(AS_PEGS)};
-uint16_t *peg_eep_start = 0;
+void
+peg_track_reset(void)
+{
+	FOREACH_PEG(p) {
+		p->open_lvl = 0;
+		p->covered_lvl = 0;
+		p->seen = 0;
+	}
+}
+
+//how far the nearer of the known baselines is from thresh, 0 when neither is known or one is on the wrong side
+uint16_t
+peg_margin(const struct peg *p)
+{
+	uint16_t m = UINT16_MAX;
+	if (p->seen & PEG_SEEN_OPEN) {
+		uint16_t open = p->open_lvl >> PEG_TRACK_FRAC;
+		m = open > p->thresh ? open - p->thresh : 0;
+	}
+	if (p->seen & PEG_SEEN_COVERED) {
+		uint16_t covered = p->covered_lvl >> PEG_TRACK_FRAC;
+		uint16_t c = covered < p->thresh ? p->thresh - covered : 0;
+		if (c < m) m = c;
+	}
+	return m == UINT16_MAX ? 0 : m;
+}
+
+//drops the tracked baselines too, they were learnt against the old thresholds
 void
 read_peggy_thresholds(void)
 {
 	for (int i = 0; i < PEG_COUNT;i++)
-		pegs[i].thresh = eeprom_read_word(peg_eep_start+i);
+		pegs[i].thresh = settings.peg_thresh[i];
+	peg_track_reset();
 }
 
 void
 write_peggy_thresholds(void)
 {
 	for (int i = 0; i < PEG_COUNT;i++)
-		eeprom_update_word(peg_eep_start+i, pegs[i].thresh);
+		settings.peg_thresh[i] = pegs[i].thresh;
+	settings_save();
+	peg_track_reset();
+}
+
+struct cal_stat {
+	uint8_t n;
+	uint16_t min, max;
+	uint32_t sum;
+};
+
+_Static_assert(PEG_COUNT <= 8, "calibrated pegs are tracked in a byte");
+static struct {
+	uint8_t phase;
+	uint8_t done; // pegs whose covered readings are all in
+	ms_time_t started;
+	ms_time_t sampled;
+	struct cal_stat open[PEG_COUNT];
+	struct cal_stat covered[PEG_COUNT];
+} cal;
+
+static void
+cal_note(struct cal_stat *s, uint16_t v)
+{
+	if (!s->n || v < s->min) s->min = v;
+	if (!s->n || v > s->max) s->max = v;
+	s->sum += v;
+	s->n++;
+}
+
+static uint16_t
+cal_mean(const struct cal_stat *s)
+{
+	return s->n ? s->sum / s->n : 0;
+}
+
+static uint16_t
+cal_thresh(uint8_t i)
+{
+	return (cal_mean(&cal.open[i]) + 4*cal_mean(&cal.covered[i])) / 5;
+}
+
+//distance from the new threshold to the nearest reading of either level, negative if the levels overlap it
+static int16_t
+cal_margin(uint8_t i)
+{
+	if (!(cal.done & (1 << i))) return 0;
+	int16_t t = cal_thresh(i);
+	int16_t open = cal.open[i].min - t;
+	int16_t covered = t - cal.covered[i].max;
+	return open < covered ? open : covered;
+}
+
+static void
+cal_finish(uint8_t result)
+{
+	cal.phase = result;
+	if (result == PEG_CAL_STORED) {
+		for (int i = 0; i < PEG_COUNT; i++)
+			pegs[i].thresh = cal_thresh(i);
+		write_peggy_thresholds();
+		sound_play(SOUND_cal_done);
+	} else {
+		sound_play(SOUND_cal_fail);
+	}
+}
+
+static void
+cal_tick(ms_time_t now)
+{
+	if (now - cal.started > PEG_CAL_TIMEOUT) {
+		cal_finish(PEG_CAL_TIMED_OUT);
+		return;
+	}
+	if (now - cal.sampled < PEG_CAL_SAMPLE_MS) return;
+	cal.sampled = now;
+
+	if (cal.phase == PEG_CAL_OPEN) {
+		FOREACH_PEG(p) cal_note(&cal.open[p->loc], adc_values[p->adc_ix]);
+		if (cal.open[0].n == PEG_CAL_SAMPLES) {
+			cal.phase = PEG_CAL_COVER;
+			sound_play(SOUND_cal_step);
+		}
+		return;
+	}
+
+	FOREACH_PEG(p) {
+		uint8_t i = p->loc;
+		uint16_t v = adc_values[p->adc_ix];
+		if (cal.done & (1 << i)) continue;
+		//lifting the peg again before it is done starts it over
+		if (v + PEG_CAL_COVER_DROP > cal_mean(&cal.open[i])) {
+			cal.covered[i].n = 0;
+			cal.covered[i].sum = 0;
+			continue;
+		}
+		cal_note(&cal.covered[i], v);
+		if (cal.covered[i].n == PEG_CAL_SAMPLES) {
+			cal.done |= (1 << i);
+			sound_play(SOUND_cal_step);
+		}
+	}
+	if (cal.done != (1 << PEG_COUNT) - 1) return;
+
+	for (int i = 0; i < PEG_COUNT; i++)
+		if (cal_margin(i) < PEG_CAL_MIN_MARGIN) {
+			cal_finish(PEG_CAL_REJECTED);
+			return;
+		}
+	cal_finish(PEG_CAL_STORED);
+}
+
+static int
+cal_running(void)
+{
+	return cal.phase == PEG_CAL_OPEN || cal.phase == PEG_CAL_COVER;
+}
+
+void
+peg_cal_start(void)
+{
+	if (peggy_task_running() || cal_running()) return;
+	//a peg left on would give a low open mean and could never count as covered
+	FOREACH_PEG(p) {
+		if (p->state != PEG_STATE_CLEAR) {
+			cal.phase = PEG_CAL_PEGS_ON;
+			sound_play(SOUND_cal_fail);
+			return;
+		}
+	}
+	memset(&cal, 0, sizeof(cal));
+	cal.phase = PEG_CAL_OPEN;
+	cal.started = millis();
+	cal.sampled = cal.started;
 }
 
 void
-self_calibrate_peggy_thresholds(void)
+peg_cal_abort(void)
 {
-	// TODO self calibrate. not as easy as it sounds because we need to measure each sensor with both peg and open to get a good threshold (probably just the center of those two measurements) so this function needs to interact with a user. Fortunately it only needs to interact with a knowledgeable user.
-	// A likely workflow: device determines all values for open pegs, then detects big changes when someone covers a peg. It makes a changing tone/rate of beeping to indicate that it is time to move to the next
+	if (cal_running())
+		cal.phase = PEG_CAL_IDLE;
+}
+
+uint8_t
+peg_cal_report(uint8_t *Data)
+{
+	uint16_t open[PEG_COUNT], covered[PEG_COUNT];
+	int16_t margin[PEG_COUNT];
+	for (int i = 0; i < PEG_COUNT; i++) {
+		open[i] = cal_mean(&cal.open[i]);
+		covered[i] = cal_mean(&cal.covered[i]);
+		margin[i] = cal_margin(i);
+	}
+	pack_peg_calibration(Data, cal.phase, cal.done, open, covered, margin);
+	return sizeof(struct report_peg_calibration);
 }
 
 int
 play_stage_success(int x)
 {
-	if (x) start_flashing(&buzzer_as_led, 10, 50, 50);
+	if (x) sound_play(SOUND_stage_success);
 	return x;
 }
 
@@ -127,14 +332,16 @@ handle_drops(void)
 	//for now do simple thing
 	//*
 	if (adc_values[DROP_ERROR_LINE] > DROP_THRESH) {
-		buzzer_as_led.on();
+		if (!buzzer_because_drop)
+			sound_play(SOUND_drop);
 		buzzer_because_drop = 1;
 	} else {
 		if (buzzer_because_drop) {
 			buzzer_because_drop = 0;
-			buzzer_as_led.off();
+			sound_release();
 			//send drop error reason
-			new_drop_error(&derrbuf, host_millis());
+			new_drop_error(&derrbuf, millis());
+			session_note_drop();
 		}
 	}
 	//*/
@@ -280,11 +487,24 @@ peggy_stm_loop(void)
 	if (lms_said_to_start) {// restart on receipt of timestamp
 		cur = &wait_to_start;
 		// TODO Pokey beeps continuously if you reset while an error is occurring. Peggy stops, but resumes if you take the tool away and make a new error 
-		buzzer_as_led.off();
+		sound_stop();
+		peg_cal_abort();
+	}
+	if (cal_running()) {
+		cal_tick(millis());
+		return;
 	}
 	int r = cur->f();
-	if (r)
+	if (r) {
+		if (cur == &wait_to_start) {
+			//drop contacts queued while no task was running
+			reset_wall_errors();
+			session_begin();
+		}
+		else if (cur == &c2l)
+			session_end(SESSION_COMPLETED);
 		cur = cur->next;
+	}
 }
 
 int
@@ -292,3 +512,9 @@ peggy_cur_state(void)
 {
 	return cur->msg;
 }
+
+int
+peggy_task_running(void)
+{
+	return cur != &wait_to_start;
+}
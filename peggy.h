@@ -1,3 +1,5 @@
+#ifndef _PEGGY_H_
+#define _PEGGY_H_
 //name, port, num, adc line
 #define PEG_COUNT 6
 #define PEG_TABLE(_) _(peg1, PORTF, DDRF, PF0, 0, 0)\
@@ -8,22 +10,56 @@
   _(peg6, PORTF, DDRF, PF7, 7, 5)
 #define DROP_THRESH 0x003E
 
+//a peg starts out in neither state until its first reading
 #define PEG_STATE_CAPPED 1
 #define PEG_STATE_CLEAR 3
-#define PEG_STATE_CAPPING 2
-#define PEG_STATE_CLEARING 4
+/* Baseline tracking: while a peg is steady its open or covered level is followed with a slow running average, and
+ * once both are known thresh is placed between them the way peggy_vals_as_hex.py does, (open+4*covered)/5. The
+ * stored threshold in settings stays the reference, the live one may only wander PEG_DRIFT_MAX from it. */
+#ifndef PEG_TRACK_MS
+#define PEG_TRACK_MS 250 // one baseline sample per peg this often
+#endif
+#define PEG_TRACK_SHIFT 6 // each sample moves the average 1/64 of the way, about 16 s to follow a lighting change
+#define PEG_TRACK_FRAC 4 // baselines are kept in 1/16 adc counts
+#define PEG_RETUNE_HYST 8 // thresh only moves once the new one is this many counts away
+#define PEG_MIN_SPAN 64 // open and covered closer than this are not trusted to place a threshold
+#define PEG_DRIFT_MAX 128
+#define PEG_SEEN_OPEN 1
+#define PEG_SEEN_COVERED 2
+
+/* Change detection: a one sided CUSUM per peg sums, every PEG_CUSUM_MS, how far the reading is past thresh toward
+ * the other state, less a slack of PEG_CUSUM_K, and confirms the change once the sum reaches PEG_CUSUM_H. A clean
+ * move confirms in about H/(CLAMP-K) samples, 90 ms with these numbers, and since one reading adds at most
+ * PEG_CUSUM_CLAMP a single glitch never does. Raising H makes false changes exponentially rarer and real ones
+ * only linearly slower. Whatever the CUSUM misses, like a reading that settles just past thresh, the peg debouncer
+ * still confirms within its fixed delay. */
+#ifndef PEG_CUSUM_H
+#define PEG_CUSUM_H 1000
+#endif
+#ifndef PEG_CUSUM_K
+#define PEG_CUSUM_K 16
+#endif
+#define PEG_CUSUM_CLAMP 128
+#define PEG_CUSUM_MS 10
+
 struct peg {
-	int adc_ix;
+	uint8_t adc_ix;
 	uint8_t loc;
-	ms_time_t state_start;
-	unsigned int thresh;
+	uint16_t thresh;
 	uint8_t state;
+	uint16_t open_lvl; // baselines in 1/16 counts
+	uint16_t covered_lvl;
+	uint8_t seen; // PEG_SEEN_ bits of the baselines that hold a value
+	ms_time_t tracked;
+	int16_t cusum;
+	ms_time_t cusum_at;
+	ms_time_t cusum_start; // when the sum last left 0, the estimated onset
 };
 
 struct peg pegs[PEG_COUNT];
 
 void
-peg_tick(struct peg *);
+peg_tick(struct peg *, ms_time_t now);
 
 void
 peggy_hardware(void);
@@ -36,11 +72,37 @@ void
 write_peggy_thresholds(void);
 void
 read_peggy_thresholds(void);
+void
+peg_track_reset(void);
 
-//TODO compile-time check that PEG_COUNT <= 8
-uint8_t peg_msg_state;
-uint8_t peg_msg_pending;
-TIME_t peg_stamps[PEG_COUNT];
+/* Self calibration, started over the peg_calibration feature report while no task runs; pins.txt lists a production
+ * test button for this too, but no pin for it is mapped in the firmware. It refuses to start, with PEG_CAL_PEGS_ON,
+ * unless every peg reads clear. It first takes PEG_CAL_SAMPLES readings of every open sensor, beeps, then waits for
+ * each peg to be put on, which shows as a drop of PEG_CAL_COVER_DROP under its open mean, and takes as many covered
+ * readings, beeping once a peg is done. The thresholds are stored only if every peg keeps PEG_CAL_MIN_MARGIN between
+ * the new threshold and the nearest reading of either level. */
+#define PEG_CAL_IDLE 0
+#define PEG_CAL_OPEN 1
+#define PEG_CAL_COVER 2
+#define PEG_CAL_STORED 3
+#define PEG_CAL_REJECTED 4
+#define PEG_CAL_TIMED_OUT 5
+#define PEG_CAL_PEGS_ON 6
+#define PEG_CAL_SAMPLES 64
+#define PEG_CAL_SAMPLE_MS 10
+#define PEG_CAL_COVER_DROP 128
+#define PEG_CAL_MIN_MARGIN 32
+#define PEG_CAL_TIMEOUT 120000
 
 void
-set_peg_msg(uint8_t peg, uint8_t state);
+peg_cal_start(void);
+void
+peg_cal_abort(void);
+uint8_t
+peg_cal_report(uint8_t *Data);
+uint16_t
+peg_margin(const struct peg *);
+
+int
+peggy_task_running(void);
+#endif
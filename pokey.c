@@ -1,79 +1,50 @@
 #include <stdlib.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "Timer.h"
 #include "box.h"
 #include "pokey.h"
 #include "adc.h"
 #include "led.h"
+#include "session_log.h"
+#include "sound.h"
+#include "debounce.h"
 
-LED_TABLE(AS_LED_OFF_FUN);
-LED_TABLE(AS_LED_ON_FUN);
+LED_TABLE(AS_LED_PIN)
+_Static_assert((LED_COUNT + LED_SCAN_PHASES - 1) / LED_SCAN_PHASES <= MAX_LEDS_ON_AT_ONCE,
+	"target LEDs lit per scan phase exceed the current budget");
 
 #define FOREACH_POKEY_LED(key) for (struct led *key=leds;key<&leds[LED_COUNT];key++)
 
-#define AS_LED_ARRAY_INIT(name, port, ddr, num) {.on = name ## _on, .off = name ## _off},
+#define AS_LED_ARRAY_INIT(name, port, ddr, num) {.pin = &led_pin_ ## name},
 struct led leds[LED_COUNT] = {LED_TABLE(AS_LED_ARRAY_INIT)};
 
-inline int
-int_buffer_full(struct int_buffer *ib)
-{
-	return !(ib->occupancy < MAX_LEDS_ON_AT_ONCE);
-}
-void
-int_buffer_put(struct int_buffer *ib, int v)
-{
-	if (int_buffer_full(ib)) return;
-	
-	ib->buf[ib->first_empty] = v;
-	ib->occupancy++;
-	ib->first_empty++;
-	ib->first_empty %= MAX_LEDS_ON_AT_ONCE;
-}
-
-int
-int_buffer_extract(struct int_buffer *ib)
-{
-	if (!ib->occupancy) return -1;
-	int res = ib->buf[ib->first_real];
-	ib->occupancy--;
-	ib->first_real++;
-	ib->first_real %= MAX_LEDS_ON_AT_ONCE;
-	return res;
-}
-struct int_buffer ledbuf;//initializing to zero fulfills invariants
 void
 led_on(int led)
 {
-	//Make a ring buffer of interior leds that are on. The function to turn on an interior led checks if the buffer is full. If it is the least recently turned on is turned off and removed, then the new one is turned on and added
-	
-	//check that argument is valid
-	if (led > LED_COUNT) return;
-	
-	struct led *l = &leds[led];
-	
-	//check if ringbuffer is full
-	if (int_buffer_full(&ledbuf)) {
-		//drop first in, turn it off
-		int ix = int_buffer_extract(&ledbuf);
-		leds[ix].off();
-	}
-	l->on();
-	//add l to ringbuffer
-	int_buffer_put(&ledbuf, led);
-		
+	//any number of targets can be lit, the led engine scans them to stay within MAX_LEDS_ON_AT_ONCE worth of current
+	if (led < 0 || led >= LED_COUNT) return;
+	led_turn_on(&leds[led]);
 }
 
 //all buttons are on the mux and at 1-10 so making a table of them does not make a lot of sense
 uint8_t button_values[BUTTON_COUNT];
 
+//bit i is the level of button i from the last complete scan, filled by the Timer1 interrupt
+static volatile uint16_t button_bits = (1 << BUTTON_COUNT) - 1; // released until the first scan
+
 void
 read_buttons(void)
 {
-	PORTB &= ~(1<<PB0);
-	for (int i = 0; i < BUTTON_COUNT;i++) {
-		set_muxer(i+1);
-		button_values[i] = !!(PINB & (1<<PB4));
+	uint16_t bits;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		bits = button_bits;
 	}
+	for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+		button_values[i] = !!(bits & (1 << i));
+	debounce_put_bits(DB_button0, BUTTON_COUNT, bits);
 }
 
 //fisher yates
@@ -94,23 +65,31 @@ shuffle(uint8_t *arr, int n) {
 //sensors
 #define ADC_MUX_LINE 11
 
+//the select lines are PD0-PD3, in order, so a channel goes out in one write
+#define MUX_SELECT_MASK ((1<<PD0)|(1<<PD1)|(1<<PD2)|(1<<PD3))
 void
 set_muxer(uint8_t val)
 {
-	//set arg of muxer to val, wait however many nanoseconds (possibly no need to wait)
-	int ix0, ix1, ix2, ix3;
-	ix0 = !!(val&1);
-	ix1 = !!(val&2);
-	ix2 = !!(val&4);
-	ix3 = !!(val&8);
-	PORTD &= ~((1<<PD0)|(1<<PD1)|(1<<PD2)|(1<<PD3));
-	if (ix0) PORTD |= (1<<PD0);
-	if (ix1) PORTD |= (1<<PD1);
-	if (ix2) PORTD |= (1<<PD2);
-	if (ix3) PORTD |= (1<<PD3);
-	
-	//no waiting necessary
-	
+	PORTD = (PORTD & ~MUX_SELECT_MASK) | (val & MUX_SELECT_MASK);
+}
+
+/* One channel per tick: the channel selected last tick has had MUX_SETTLE_US to settle, so read it, then select the
+ * next. Button i is on channel i+1. A full scan takes BUTTON_COUNT ticks and is published at once. */
+ISR(TIMER1_COMPA_vect)
+{
+	static uint8_t ch;
+	static uint16_t scan;
+
+	//the mux is enabled while PB0 is low, keep it that way whatever else wrote port B
+	PORTB &= ~(1<<PB0);
+	if (PINB & (1<<PB4))
+		scan |= (1 << ch);
+	if (++ch == BUTTON_COUNT) {
+		ch = 0;
+		button_bits = scan;
+		scan = 0;
+	}
+	PORTD = (PORTD & ~MUX_SELECT_MASK) | (ch + 1);
 }
 
 void
@@ -120,22 +99,20 @@ muxer_init()
 	DDRB |= (1<<PB0);
 	PORTB &= ~(1<<PB0);
 	DDRB &= ~(1<<PB4);
-	DDRD |= (1<<PD0)|(1<<PD1)|(1<<PD2)|(1<<PD3);;
-	
-}
-
-void
-pokey_flash_handler(void)
-{
-	ms_time_t now = millis();
-	FOREACH_POKEY_LED(l) do_flashing(l, now);
+	DDRD |= MUX_SELECT_MASK;
+	set_muxer(1);
+
+	//scan tick, CTC on OCR1A at clk/8
+	TCCR1A = 0;
+	TCCR1B = (1<<WGM12)|(1<<CS11);
+	OCR1A = (F_CPU / 8 / 1000000UL) * MUX_SETTLE_US - 1;
+	TIMSK1 |= (1<<OCIE1A);
 }
 
 void
 pokey_test_leds(void)
 {
 	FOREACH_POKEY_LED(l) start_flashing(l, 5, 1000, 1000);
-	//this turns on all leds, don't leave on
 }
 
 #define FOREACH_TARGET(key) for (struct target *key=targets;key<&targets[TARGET_COUNT];key++)
@@ -168,7 +145,7 @@ void check_pieces_init(void)
 	game_end_type = 0;
 	lms_said_to_end = 0;
 	game_going = 0;
-	FOREACH_TARGET(t) t->led->off();
+	FOREACH_TARGET(t) led_turn_off(t->led);
 }
 void check_pieces(void)
 {
@@ -176,7 +153,7 @@ void check_pieces(void)
 	//game happens here
 	while (!game_started) {
 		game_start_time = millis();
-		new_event(&evtbuf, host_millis(), LOC_START);
+		new_event(&evtbuf, millis(), LOC_START);
 		game_started = 1;
 		reset_wall_errors();
 	}
@@ -197,8 +174,11 @@ void check_pieces(void)
 	handle_wall_errors();
 	
 	if ((timeout != 0 && (millis() - game_start_time) > timeout) || lms_said_to_end) {
-		new_event(&evtbuf, host_millis(), LOC_TIMEOUT);
+		new_event(&evtbuf, millis(), LOC_TIMEOUT);
+		session_end(lms_said_to_end ? SESSION_ABORTED : SESSION_TIMED_OUT);
 		//TODO change next state or set a variable or something to indicate the timeout
+		if (!game_end_type)
+			sound_play(SOUND_timeout);
 		game_end_type = END_FAILURE;
 	}
 	
@@ -207,17 +187,19 @@ void check_pieces(void)
     FOREACH_TARGET(t) {
 		if (t != &targets[target_order[target_in_play]]) continue;
 		//top front middle is impossible
-	    if (!button_values[t->button_ix] || target_order[target_in_play] == 2) {
-			t->led->off();
-			new_poke(&pokebuf, host_millis(), t->loc);
+	    if (!debounced(DB_button0 + t->button_ix) || target_order[target_in_play] == 2) {
+			led_turn_off(t->led);
+			new_poke(&pokebuf, millis(), t->loc);
 			//if last target, play happy sound
-			if (target_in_play == 9)
-				start_flashing(&buzzer_as_led, 10, 50, 50);
+			if (target_in_play == 9) {
+				sound_play(SOUND_stage_success);
+				session_end(SESSION_COMPLETED);
+			}
 			//update which organ is the current organ
 			target_in_play++;
 			if (target_in_play == 10) break; // Don't go through again if we're done. This fixes the issue where top back light would turn on.
 		} else {
-			t->led->on();
+			led_turn_on(t->led);
 		}
     }
 }
@@ -226,6 +208,9 @@ void
 pokey_init(void)
 {
 	LED_TABLE(AS_ENABLE_OUTPUT);
+	FOREACH_POKEY_LED(l) led_register_scanned(l);
+	for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+		debounce_preset(DB_button0 + i, 1);
 	muxer_init();
 }
 
@@ -234,7 +219,8 @@ pokey_loop(void)
 {
 	if (lms_said_to_start && !tool_in_slot()) {
 		check_pieces_init();
-		buzzer_off();
+		session_begin();
+		sound_stop();
 		game_going = 1;
 		lms_said_to_start = 0;
 		target_in_play = 0;
@@ -243,7 +229,13 @@ pokey_loop(void)
 		check_pieces();
 	if (target_in_play >= TARGET_COUNT && tool_in_slot()) {
 		game_going = 0;
-		buzzer_off();
-		error_led->off();
+		sound_stop();
+		led_turn_off(error_led);
 	}
 }
+
+int
+pokey_task_running(void)
+{
+	return game_going;
+}
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "Config/AppConfig.h"
+#include "Timer.h"
+#include "led.h"
+#include "box.h"
+#include "adc.h"
+#include "WireConversions.h"
+#include "reports.h"
+#include "report_sched.h"
+
+_Static_assert(SOURCE_COUNT <= 8, "ready sources are tracked in a byte");
+
+#define AS_SOURCE_PRIO(name, id, prio, deadline, weight, clock) prio,
+#define AS_SOURCE_DEADLINE(name, id, prio, deadline, weight, clock) deadline,
+#define AS_SOURCE_WEIGHT(name, id, prio, deadline, weight, clock) weight,
+static const uint8_t source_prio[SOURCE_COUNT] PROGMEM = {REPORT_SOURCES(AS_SOURCE_PRIO)};
+static const uint16_t source_deadline[SOURCE_COUNT] PROGMEM = {REPORT_SOURCES(AS_SOURCE_DEADLINE)};
+static const uint8_t source_weight[SOURCE_COUNT] PROGMEM = {REPORT_SOURCES(AS_SOURCE_WEIGHT)};
+
+static uint8_t send_status;
+static ms_time_t status_stamp;
+static ms_time_t raw_stamp;
+
+static int16_t credit[SOURCE_COUNT];
+static uint16_t latency_hist[SOURCE_COUNT][LATENCY_BUCKETS];
+static uint16_t latency_worst[SOURCE_COUNT];
+
+/* Each source has <name>_ready(), which says whether it has something to send and since when (device millis), and
+ * <name>_emit(), which fills the report and returns its length. */
+static bool
+status_ready(ms_time_t *since)
+{
+	*since = status_stamp;
+	return send_status;
+}
+static uint8_t
+status_emit(uint8_t *Data)
+{
+	uint8_t st[4];
+
+	send_status = 0;
+	uint32_to_wire(status, st);
+	pack_status(Data, host_millis(), st);
+	return sizeof(struct report_status);
+}
+
+static bool
+poke_ready(ms_time_t *since)
+{
+	*since = pokebuf.stamps[pokebuf.first_real];
+	return pokebuf.occupancy;
+}
+static uint8_t
+poke_emit(uint8_t *Data)
+{
+	extract_poke(&pokebuf, Data, sizeof(struct report_poke));
+	return sizeof(struct report_poke);
+}
+
+//pegs moved together are confirmed a little apart, so the oldest change is held back a moment to gather them,
+//counted from when it was confirmed since its stamp is the onset, which can be long before
+static bool
+peg_snapshot_ready(ms_time_t *since)
+{
+	*since = pegbuf.queued[pegbuf.first_real] + PEG_SNAPSHOT_HOLD;
+	return pegbuf.occupancy && (int32_t)(millis() - *since) >= 0;
+}
+static uint8_t
+peg_snapshot_emit(uint8_t *Data)
+{
+	extract_peg_snapshot(&pegbuf, Data, sizeof(struct report_peg_snapshot));
+	return sizeof(struct report_peg_snapshot);
+}
+
+//this records whether it's in or out, not the tool state
+static bool
+tool_ready(ms_time_t *since)
+{
+	*since = toolbuf.stamps[toolbuf.first_real];
+	return toolbuf.occupancy;
+}
+static uint8_t
+tool_emit(uint8_t *Data)
+{
+	extract_tool(&toolbuf, Data, sizeof(struct report_tool));
+	return sizeof(struct report_tool);
+}
+
+//queued when the episode closes, which is no earlier than stamp + duration
+static bool
+wall_error_ready(ms_time_t *since)
+{
+	*since = werrbuf.stamps[werrbuf.first_real] + werrbuf.durs[werrbuf.first_real];
+	return werrbuf.occupancy;
+}
+static uint8_t
+wall_error_emit(uint8_t *Data)
+{
+	extract_wall_error(&werrbuf, Data, sizeof(struct report_wall_error));
+	return sizeof(struct report_wall_error);
+}
+
+static bool
+drop_error_ready(ms_time_t *since)
+{
+	*since = derrbuf.stamps[derrbuf.first_real];
+	return derrbuf.occupancy;
+}
+static uint8_t
+drop_error_emit(uint8_t *Data)
+{
+	extract_drop_error(&derrbuf, Data, sizeof(struct report_drop_error));
+	return sizeof(struct report_drop_error);
+}
+
+//TODO FEATURE add output report on this number that toggles sending these on or off
+static bool
+event_ready(ms_time_t *since)
+{
+	*since = evtbuf.stamps[evtbuf.first_real];
+	return false; //evtbuf.occupancy;
+}
+static uint8_t
+event_emit(uint8_t *Data)
+{
+	extract_event(&evtbuf, Data, sizeof(struct report_event));
+	return sizeof(struct report_event);
+}
+
+//streams at a fixed rate while enabled, ratelimited because chrome
+static bool
+raw_values_ready(ms_time_t *since)
+{
+	*since = raw_stamp + RAW_VALUES_INTERVAL;
+	return send_raw && (int32_t)(millis() - *since) >= 0;
+}
+static uint8_t
+raw_values_emit(uint8_t *Data)
+{
+	//all 3 tool adcs, all 6+1 peggy optic adcs, all 10 pokey buttons
+	uint16_t adcs[10] = {
+		adc_values[TOOL_ERROR_LINE], adc_values[TOOL_HOLDER_LINE], adc_values[TOOL_CONNECTED_LINE],
+		adc_values[0], adc_values[1], adc_values[4], adc_values[5], adc_values[6], adc_values[7],
+		adc_values[DROP_ERROR_LINE],
+	};
+
+	raw_stamp = millis();
+	pack_raw_values(Data, adcs, button_values, tool_confidence);
+	return sizeof(struct report_raw_values);
+}
+
+static void
+record_latency(uint8_t src, ms_time_t lat)
+{
+	uint8_t b = 0;
+
+	if ((int32_t)lat < 0)
+		lat = 0;
+	if (lat > UINT16_MAX)
+		lat = UINT16_MAX;
+	if (lat > latency_worst[src])
+		latency_worst[src] = lat;
+	for (ms_time_t l = lat; l && b < LATENCY_BUCKETS-1; l >>= 1)
+		b++;
+	if (latency_hist[src][b] < UINT16_MAX)
+		latency_hist[src][b]++;
+}
+
+void
+report_sched_status(void)
+{
+	send_status = 1;
+	status_stamp = millis();
+}
+
+/* Picks the next IN report. Returns false when there is nothing to send. */
+bool
+report_sched_next(uint8_t *Data, uint8_t *ReportID, uint16_t *ReportSize, uint8_t synced)
+{
+	ms_time_t now = millis();
+	ms_time_t since[SOURCE_COUNT];
+	uint8_t ready = 0;
+	int8_t pick = -1;
+
+	#define AS_SOURCE_READY(name, id, prio, deadline, weight, clock) \
+		if ((synced || !clock) && name##_ready(&since[SOURCE_##name])) \
+			ready |= (1 << SOURCE_##name);
+	REPORT_SOURCES(AS_SOURCE_READY)
+	if (!ready)
+		return false;
+
+	//anything past its deadline goes first, the most urgent priority and then the longest waiting
+	for (int8_t i = 0; i < SOURCE_COUNT; i++) {
+		if (!(ready & (1 << i)) || (int32_t)(now - since[i]) < (int32_t)pgm_read_word(&source_deadline[i])) continue;
+		if (pick < 0 || pgm_read_byte(&source_prio[i]) > pgm_read_byte(&source_prio[pick])
+				|| (pgm_read_byte(&source_prio[i]) == pgm_read_byte(&source_prio[pick])
+					&& (int32_t)(since[i] - since[pick]) < 0))
+			pick = i;
+	}
+	//otherwise smooth weighted round robin over the ready sources
+	if (pick < 0) {
+		int16_t total = 0;
+		for (int8_t i = 0; i < SOURCE_COUNT; i++) {
+			if (!(ready & (1 << i))) {
+				credit[i] = 0;
+				continue;
+			}
+			credit[i] += pgm_read_byte(&source_weight[i]);
+			total += pgm_read_byte(&source_weight[i]);
+			if (pick < 0 || credit[i] > credit[pick])
+				pick = i;
+		}
+		credit[pick] -= total;
+	}
+
+	switch (pick) {
+	#define AS_SOURCE_EMIT(name, id, prio, deadline, weight, clock) \
+	case SOURCE_##name: \
+		*ReportSize = name##_emit(Data); \
+		*ReportID = id; \
+		break;
+	REPORT_SOURCES(AS_SOURCE_EMIT)
+	}
+	record_latency(pick, now - since[pick]);
+	return true;
+}
+
+uint8_t
+report_sched_latency(uint8_t *Data)
+{
+	pack_report_latency(Data, &latency_hist[0][0], latency_worst);
+	return sizeof(struct report_report_latency);
+}
+
+void
+report_sched_latency_clear(void)
+{
+	memset(latency_hist, 0, sizeof(latency_hist));
+	memset(latency_worst, 0, sizeof(latency_worst));
+}
@@ -0,0 +1,47 @@
+#ifndef _REPORT_SCHED_H_
+#define _REPORT_SCHED_H_
+	#include <stdint.h>
+	#include <stdbool.h>
+	#include "Config/AppConfig.h"
+	#include "Timer.h"
+
+	/* Sources of IN reports: name, report id, priority, deadline (ms), weight, waits for the host clock.
+	 *
+	 * Each time the IN bank is free the scheduler sends from the source that is furthest past its deadline, higher
+	 * priority first. When nothing is overdue the ready sources share the link by weight, so a busy source cannot
+	 * starve a quiet one. Sources that wait for the host clock are held while the time is not synced.
+	 */
+	#define REPORT_SOURCES(_) \
+		_(status,       MSG_STATUS_ID,       7, 0,   1, 0) \
+		_(poke,         MSG_POKE_ID,         5, 20,  4, 1) \
+		_(peg_snapshot, MSG_PEG_SNAPSHOT_ID, 5, 20,  4, 1) \
+		_(tool,         MSG_TOOL_ID,         4, 20,  2, 1) \
+		_(wall_error,   MSG_WALL_ERROR_ID,   3, 50,  2, 1) \
+		_(drop_error,   MSG_DROP_ERROR_ID,   3, 50,  2, 1) \
+		_(event,        MSG_EVENT_ID,        1, 100, 1, 1) \
+		_(raw_values,   RAW_VALUES_ID,       0, 500, 1, 0)
+
+	#define AS_SOURCE_ENUM(name, id, prio, deadline, weight, clock) SOURCE_##name,
+	enum report_source {
+		REPORT_SOURCES(AS_SOURCE_ENUM)
+		SOURCE_COUNT
+	};
+
+	// log2 buckets of the time from an event being detected to its report leaving: 0, 1, 2-3, ... 32-63, 64+ ms
+	#define LATENCY_BUCKETS 8
+	// ms between raw value reports while streaming
+	#define RAW_VALUES_INTERVAL 100
+	// ms from a peg change's confirmation that it waits for the other pegs of a stage to join its snapshot
+	#define PEG_SNAPSHOT_HOLD 150
+
+	uint8_t send_raw;
+
+	void
+	report_sched_status(void);
+	bool
+	report_sched_next(uint8_t *Data, uint8_t *ReportID, uint16_t *ReportSize, uint8_t synced);
+	uint8_t
+	report_sched_latency(uint8_t *Data);
+	void
+	report_sched_latency_clear(void);
+#endif
@@ -0,0 +1,273 @@
+#ifndef _REPORTS_H_
+#define _REPORTS_H_
+	#include <stdint.h>
+	#include <string.h>
+	#include "Config/AppConfig.h"
+	#include "Timer.h"
+	#include "WireConversions.h"
+	#include "peggy.h"
+	#include "pokey.h"
+	#include "session_log.h"
+	#include "report_sched.h"
+	#include "contact.h"
+	#include "settings.h"
+
+	/* Report schema. Every report the box speaks is listed once in REPORTS and its fields once in REPORT_FIELDS_<name>.
+	 * From these, Descriptors.c builds the SimpleHID report descriptor for each box, and this file builds the wire
+	 * layout (struct report_<name>), the length per box (POKEY_LEN_<name>, PEGGY_LEN_<name>) and pack_<name>() /
+	 * unpack_<name>() which convert straight between C values and the big-endian wire bytes.
+	 *
+	 * Report:  _(name, report id, In/Out/Feature, OBJECT/ARRAY, boxes)
+	 * Field:   _(name, UINT/UINTS/INT/INTS/UTF8/EMPTY, bits per element, element count, boxes)
+	 *
+	 * OBJECT fields are named with their string descriptor, so the name must be in NAMED_STRINGS; ARRAY fields are
+	 * anonymous on the wire and only named here. UINT is a single value, UINTS an array of them, INT and INTS the same two's complement. Boxes is ALL, POKEY
+	 * or PEGGY; fields limited to one box must come last so the layout is the same for both.
+	 */
+	#define REPORTS(_, ...) \
+		_(__VA_ARGS__, config,           MSG_CONFIG_ID,              Feature, OBJECT, ALL) \
+		_(__VA_ARGS__, timestamp,        TIMESTAMP_OFFSET_FR_ID,     Out,     ARRAY,  ALL) \
+		_(__VA_ARGS__, status,           MSG_STATUS_ID,              In,      OBJECT, ALL) \
+		_(__VA_ARGS__, wall_error,       MSG_WALL_ERROR_ID,          In,      OBJECT, ALL) \
+		_(__VA_ARGS__, drop_error,       MSG_DROP_ERROR_ID,          In,      OBJECT, ALL) \
+		_(__VA_ARGS__, poke,             MSG_POKE_ID,                In,      OBJECT, ALL) \
+		_(__VA_ARGS__, peg_snapshot,     MSG_PEG_SNAPSHOT_ID,        In,      OBJECT, ALL) \
+		_(__VA_ARGS__, tool,             MSG_TOOL_ID,                In,      OBJECT, ALL) \
+		_(__VA_ARGS__, event,            MSG_EVENT_ID,               In,      OBJECT, ALL) \
+		_(__VA_ARGS__, box_type,         BOX_TYPE_ID,                Feature, OBJECT, ALL) \
+		_(__VA_ARGS__, toggle_raw,       RAW_VALUES_ID,              Out,     ARRAY,  ALL) \
+		_(__VA_ARGS__, raw_values,       RAW_VALUES_ID,              In,      ARRAY,  ALL) \
+		_(__VA_ARGS__, hardware_fault,   HARDWARE_FAULT_ID,          Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, peg_thresholds,   PEG_THRESHOLDS_ID,          Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, session_log,      SESSION_LOG_ID,             Feature, OBJECT, ALL) \
+		_(__VA_ARGS__, session_log_page, SESSION_LOG_ID,             Out,     OBJECT, ALL) \
+		_(__VA_ARGS__, serial_number,    SERIAL_NUMBER_ID,           Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, report_latency,   REPORT_LATENCY_ID,          Feature, OBJECT, ALL) \
+		_(__VA_ARGS__, contact_metrics,  CONTACT_METRICS_ID,         Feature, OBJECT, ALL) \
+		_(__VA_ARGS__, tool_thresholds,  TOOL_THRESHOLDS_ID,         Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, peg_drift,        PEG_DRIFT_ID,               Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, peg_calibration,  PEG_CALIBRATION_ID,         Feature, ARRAY,  ALL) \
+		_(__VA_ARGS__, bootloader,       START_BOOTLOADER_REPORT_ID, Feature, ARRAY,  ALL)
+
+	/* { timeout: Uint32, error_threshold: Uint16, merge_window: Uint16, item_order: Uint8[10] (pokey only) } */
+	#define REPORT_FIELDS_config(_, ...) \
+		_(__VA_ARGS__, timeout,         UINT,  32, 1,            ALL) \
+		_(__VA_ARGS__, error_threshold, UINT,  16, 1,            ALL) \
+		_(__VA_ARGS__, merge_window,    UINT,  16, 1,            ALL) \
+		_(__VA_ARGS__, item_order,      UINTS, 8,  TARGET_COUNT, POKEY)
+
+	/* [ Uint64 ] */
+	#define REPORT_FIELDS_timestamp(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL)
+
+	/* { timestamp: Uint64, status: Uint8[4] } */
+	#define REPORT_FIELDS_status(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, status,          UINTS, 8,  4,            ALL)
+
+	/* { timestamp: Uint64, duration: Uint32, contacts: Uint8, peak_gap: Uint16 }: one per error episode, duration is
+	 * the contact time summed over its contacts and peak_gap the longest break between two of them */
+	#define REPORT_FIELDS_wall_error(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, duration,        UINT,  32, 1,            ALL) \
+		_(__VA_ARGS__, contacts,        UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, peak_gap,        UINT,  16, 1,            ALL)
+
+	/* { timestamp: Uint64 } */
+	#define REPORT_FIELDS_drop_error(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL)
+
+	/* { timestamp: Uint64, location: Uint8 } */
+	#define REPORT_FIELDS_poke(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, location,        UINT,  8,  1,            ALL)
+
+	/* { timestamp: Uint64, state: Uint8, changed: Uint8, deltas: Uint16[6] }
+	 * bit n of state is 1 while peg n is capped, bit n of changed says peg n changed at timestamp + deltas[n] ms; a
+	 * peg that changes again before its last change is sent is in the next snapshot, so no change is lost */
+	#define REPORT_FIELDS_peg_snapshot(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, state,           UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, changed,         UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, deltas,          UINTS, 16, PEG_COUNT,    ALL)
+
+	/* { timestamp: Uint64, new_state: Uint8 } */
+	#define REPORT_FIELDS_tool(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, new_state,       UINT,  8,  1,            ALL)
+
+	/* Debug report: { timestamp: Uint64, event_number: Uint8 } */
+	#define REPORT_FIELDS_event(_, ...) \
+		_(__VA_ARGS__, timestamp,       UINT,  64, 1,            ALL) \
+		_(__VA_ARGS__, event_number,    UINT,  8,  1,            ALL)
+
+	/* { box_type: Uint8 } */
+	#define REPORT_FIELDS_box_type(_, ...) \
+		_(__VA_ARGS__, box_type,        UINT,  8,  1,            ALL)
+
+	/* None */
+	#define REPORT_FIELDS_toggle_raw(_, ...) \
+		_(__VA_ARGS__, none,            EMPTY, 0,  1,            ALL)
+
+	/* [ ...Uint16[10], ...Uint8[10], Uint8 ]: tool error, holder and connected lines, the six optical pegs and the drop
+	 * line, then the ten pokey buttons, then how far in adc counts (255 and up read as 255) the tool lines are from
+	 * flipping the tool state */
+	#define REPORT_FIELDS_raw_values(_, ...) \
+		_(__VA_ARGS__, adcs,            UINTS, 16, 10,           ALL) \
+		_(__VA_ARGS__, buttons,         UINTS, 8,  BUTTON_COUNT, ALL) \
+		_(__VA_ARGS__, confidence,      UINT,  8,  1,            ALL)
+
+	/* [ Uint64 ] */
+	#define REPORT_FIELDS_hardware_fault(_, ...) \
+		_(__VA_ARGS__, fault,           UINT,  64, 1,            ALL)
+
+	/* [ ...Uint16[6] ] */
+	#define REPORT_FIELDS_peg_thresholds(_, ...) \
+		_(__VA_ARGS__, thresholds,      UINTS, 16, PEG_COUNT,    ALL)
+
+	/* Get only, each get returns the next page: { count: Uint8, page: Uint8, records: Uint8[72] }
+	 * records holds 3 records of { seq: Uint16, start: Uint64, duration: Uint32, wall_error_time: Uint32,
+	 *                              wall_errors: Uint16, drops: Uint8, box_type: Uint8, result: Uint8, crc: Uint8 } */
+	#define REPORT_FIELDS_session_log(_, ...) \
+		_(__VA_ARGS__, count,           UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, page,            UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, records,         UINTS, 8,  SESSION_LOG_PAGE_RECORDS*SESSION_RECORD_WIRE_SIZE, ALL)
+
+	/* { page: Uint8 } (0xFF erases the log) */
+	#define REPORT_FIELDS_session_log_page(_, ...) \
+		_(__VA_ARGS__, page,            UINT,  8,  1,            ALL)
+
+	/* Set is accepted once, while no serial is stored: [ Utf8[16] ] */
+	#define REPORT_FIELDS_serial_number(_, ...) \
+		_(__VA_ARGS__, serial,          UTF8,  8,  SERIAL_NUMBER_MAX_LEN, ALL)
+
+	/* Get returns, set clears: { histogram: Uint16[8*8], worst: Uint16[8] }
+	 * histogram is LATENCY_BUCKETS counts per IN report source in REPORT_SOURCES order, worst is the longest wait in ms */
+	#define REPORT_FIELDS_report_latency(_, ...) \
+		_(__VA_ARGS__, histogram,       UINTS, 16, SOURCE_COUNT*LATENCY_BUCKETS, ALL) \
+		_(__VA_ARGS__, worst,           UINTS, 16, SOURCE_COUNT, ALL)
+
+	/* Get returns, set or the start command clears: { count: Uint16, total: Uint32, histogram: Uint16[12],
+	 * longest: Uint32 } over the wall contacts since, times in ms, histogram in CONTACT_BUCKETS log2 buckets */
+	#define REPORT_FIELDS_contact_metrics(_, ...) \
+		_(__VA_ARGS__, count,           UINT,  16, 1,            ALL) \
+		_(__VA_ARGS__, total,           UINT,  32, 1,            ALL) \
+		_(__VA_ARGS__, histogram,       UINTS, 16, CONTACT_BUCKETS, ALL) \
+		_(__VA_ARGS__, longest,         UINT,  32, 1,            ALL)
+
+	/* [ ...Uint16[3*2] ]: low then high threshold of the tool error, connected and holder lines, set is stored */
+	#define REPORT_FIELDS_tool_thresholds(_, ...) \
+		_(__VA_ARGS__, thresholds,      UINTS, 16, TOOL_LINE_COUNT*2, ALL)
+
+	/* Get returns, set forgets the baselines and goes back to the stored thresholds:
+	 * [ ...Uint16[6], ...Uint16[6], ...Int16[6], ...Uint16[6] ] per peg the tracked open and covered levels (0 until
+	 * seen), how far the live threshold has moved from the stored one, and the margin of the nearer level from it */
+	#define REPORT_FIELDS_peg_drift(_, ...) \
+		_(__VA_ARGS__, open,            UINTS, 16, PEG_COUNT,    ALL) \
+		_(__VA_ARGS__, covered,         UINTS, 16, PEG_COUNT,    ALL) \
+		_(__VA_ARGS__, drift,           INTS,  16, PEG_COUNT,    ALL) \
+		_(__VA_ARGS__, margin,          UINTS, 16, PEG_COUNT,    ALL)
+
+	/* [ Uint8, Uint8, ...Uint16[6], ...Uint16[6], ...Int16[6] ] the PEG_CAL_ phase, the pegs done as a bitmask, then
+	 * per peg the open and covered means and the margin of the new threshold. Set with phase PEG_CAL_OPEN starts a
+	 * calibration, with PEG_CAL_IDLE aborts it, the rest of a set is ignored */
+	#define REPORT_FIELDS_peg_calibration(_, ...) \
+		_(__VA_ARGS__, phase,           UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, done,            UINT,  8,  1,            ALL) \
+		_(__VA_ARGS__, open,            UINTS, 16, PEG_COUNT,    ALL) \
+		_(__VA_ARGS__, covered,         UINTS, 16, PEG_COUNT,    ALL) \
+		_(__VA_ARGS__, margin,          INTS,  16, PEG_COUNT,    ALL)
+
+	/* Set only, starts the bootloader: None */
+	#define REPORT_FIELDS_bootloader(_, ...) \
+		_(__VA_ARGS__, none,            EMPTY, 0,  1,            ALL)
+
+	/* ON_<box>_<boxes>(x) keeps x when an entry for <boxes> belongs in <box>'s view of the schema */
+	#define ON_ANY_ALL(...) __VA_ARGS__
+	#define ON_ANY_POKEY(...) __VA_ARGS__
+	#define ON_ANY_PEGGY(...) __VA_ARGS__
+	#define ON_POKEY_ALL(...) __VA_ARGS__
+	#define ON_POKEY_POKEY(...) __VA_ARGS__
+	#define ON_POKEY_PEGGY(...)
+	#define ON_PEGGY_ALL(...) __VA_ARGS__
+	#define ON_PEGGY_POKEY(...)
+	#define ON_PEGGY_PEGGY(...) __VA_ARGS__
+
+	/* wire layout, every member is a byte array so there is no padding and offsetof is the wire offset */
+	#define AS_WIRE_MEMBER(box, name, type, bits, count, boxes) uint8_t name[(bits)/8*(count)];
+	#define AS_WIRE_STRUCT(box, name, id, dir, kind, boxes) struct report_##name { REPORT_FIELDS_##name(AS_WIRE_MEMBER, box) };
+	REPORTS(AS_WIRE_STRUCT, ANY)
+
+	#define AS_FIELD_LEN(box, name, type, bits, count, boxes) ON_##box##_##boxes(+ (bits)/8*(count))
+	#define AS_REPORT_LEN(box, name, id, dir, kind, boxes) box##_LEN_##name = 0 REPORT_FIELDS_##name(AS_FIELD_LEN, box),
+	enum {
+		REPORTS(AS_REPORT_LEN, POKEY)
+		REPORTS(AS_REPORT_LEN, PEGGY)
+	};
+	/* length of a report for the running box, needs box.h */
+	#define REPORT_LEN(name) (box_type == BOX_TYPE_POKEY ? POKEY_LEN_##name : PEGGY_LEN_##name)
+
+	/* the largest report either box sends or receives, which sizes the HID driver's report buffers */
+	#define AS_UNION_MEMBER(box, name, id, dir, kind, boxes) struct report_##name name;
+	union report_any {
+		REPORTS(AS_UNION_MEMBER, ANY)
+	};
+	#define REPORT_MAX_SIZE sizeof(union report_any)
+	_Static_assert(REPORT_MAX_SIZE <= 255, "the HID driver keeps report sizes in a byte");
+
+	#define FIELD_TYPE_8 uint8_t
+	#define FIELD_TYPE_16 uint16_t
+	#define FIELD_TYPE_32 uint32_t
+	#define FIELD_TYPE_64 uint64_t
+	#define FIELD_STYPE_8 int8_t
+	#define FIELD_STYPE_16 int16_t
+	#define FIELD_STYPE_32 int32_t
+	#define FIELD_STYPE_64 int64_t
+
+	#define PACK_PARAM_UINT(bits, name) , FIELD_TYPE_##bits name
+	#define PACK_PARAM_UINTS(bits, name) , const FIELD_TYPE_##bits *name
+	#define PACK_PARAM_INT(bits, name) , FIELD_STYPE_##bits name
+	#define PACK_PARAM_INTS(bits, name) , const FIELD_STYPE_##bits *name
+	#define PACK_PARAM_UTF8(bits, name) , const uint8_t *name
+	#define PACK_PARAM_EMPTY(bits, name)
+	#define PACK_UINT(name, bits, count) bytes_to_wire(&name, (bits)/8, r->name);
+	#define PACK_UINTS(name, bits, count) \
+		for (uint8_t i = 0; i < (count); i++) bytes_to_wire(&name[i], (bits)/8, &r->name[i*((bits)/8)]);
+	#define PACK_INT PACK_UINT
+	#define PACK_INTS PACK_UINTS
+	#define PACK_UTF8(name, bits, count) memcpy(r->name, name, (count));
+	#define PACK_EMPTY(name, bits, count)
+
+	#define UNPACK_PARAM_UINT(bits, name) , FIELD_TYPE_##bits *name
+	#define UNPACK_PARAM_UINTS(bits, name) , FIELD_TYPE_##bits *name
+	#define UNPACK_PARAM_INT(bits, name) , FIELD_STYPE_##bits *name
+	#define UNPACK_PARAM_INTS(bits, name) , FIELD_STYPE_##bits *name
+	#define UNPACK_PARAM_UTF8(bits, name) , uint8_t *name
+	#define UNPACK_PARAM_EMPTY(bits, name)
+	#define UNPACK_UINT(name, bits, count) bytes_from_wire(name, (bits)/8, r->name);
+	#define UNPACK_UINTS(name, bits, count) \
+		for (uint8_t i = 0; i < (count); i++) bytes_from_wire(&name[i], (bits)/8, &r->name[i*((bits)/8)]);
+	#define UNPACK_INT UNPACK_UINT
+	#define UNPACK_INTS UNPACK_UINTS
+	#define UNPACK_UTF8(name, bits, count) memcpy(name, r->name, (count));
+	#define UNPACK_EMPTY(name, bits, count)
+
+	#define AS_PACK_PARAM(box, name, type, bits, count, boxes) PACK_PARAM_##type(bits, name)
+	#define AS_PACK_FIELD(box, name, type, bits, count, boxes) PACK_##type(name, bits, count)
+	#define AS_UNPACK_PARAM(box, name, type, bits, count, boxes) UNPACK_PARAM_##type(bits, name)
+	#define AS_UNPACK_FIELD(box, name, type, bits, count, boxes) UNPACK_##type(name, bits, count)
+	#define AS_PACKERS(box, name, id, dir, kind, boxes) \
+		static inline void pack_##name(uint8_t *Data REPORT_FIELDS_##name(AS_PACK_PARAM, box)) \
+		{ \
+			struct report_##name *r = (struct report_##name *)Data; \
+			(void)r; \
+			REPORT_FIELDS_##name(AS_PACK_FIELD, box) \
+		} \
+		static inline void unpack_##name(const uint8_t *Data REPORT_FIELDS_##name(AS_UNPACK_PARAM, box)) \
+		{ \
+			const struct report_##name *r = (const struct report_##name *)Data; \
+			(void)r; \
+			REPORT_FIELDS_##name(AS_UNPACK_FIELD, box) \
+		}
+	REPORTS(AS_PACKERS, ANY)
+#endif
@@ -0,0 +1,184 @@
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "Config/AppConfig.h"
+#include "Timer.h"
+#include "led.h"
+#include "box.h"
+#include "WireConversions.h"
+#include "session_log.h"
+#include "reports.h"
+
+//records are written round the whole region in order, so every cell sees one write per SESSION_LOG_SLOTS sessions
+#define SESSION_LOG_SLOTS ((SESSION_LOG_EEP_END - SESSION_LOG_EEP_START) / sizeof(struct session_record))
+#define SLOT_ADDR(i) ((uint8_t *)(SESSION_LOG_EEP_START + (i) * sizeof(struct session_record)))
+#define SEQ_ERASED 0xffff
+
+struct session_record cur_session;
+uint8_t session_active;
+ms_time_t session_start;
+
+/* the finished record is copied here and trickled out a byte per loop so the eeprom never blocks the main loop */
+struct session_record pending_record;
+uint8_t pending_slot, pending_written = sizeof(struct session_record);
+
+uint8_t log_next, log_count, log_cursor;
+uint16_t log_seq;
+
+static uint8_t
+record_crc(const struct session_record *r)
+{
+	uint8_t crc = 0;
+	const uint8_t *p = (const uint8_t *)r;
+	for (uint8_t i = 0; i < offsetof(struct session_record, crc); i++)
+		crc = _crc8_ccitt_update(crc, p[i]);
+	return crc;
+}
+
+static uint8_t
+read_slot(uint8_t slot, struct session_record *r)
+{
+	eeprom_read_block(r, SLOT_ADDR(slot), sizeof(*r));
+	return r->seq != SEQ_ERASED && r->crc == record_crc(r);
+}
+
+void
+session_log_init(void)
+{
+	struct session_record r;
+	uint8_t found = 0;
+	uint16_t newest = 0;
+	
+	log_count = 0;
+	log_next = 0;
+	for (uint8_t i = 0; i < SESSION_LOG_SLOTS; i++) {
+		if (!read_slot(i, &r)) continue;
+		log_count++;
+		//sequence numbers wrap, so compare by difference
+		if (!found || (int16_t)(r.seq - newest) > 0) {
+			newest = r.seq;
+			log_next = (i + 1) % SESSION_LOG_SLOTS;
+			found = 1;
+		}
+	}
+	log_seq = found ? newest + 1 : 0;
+	if (log_seq == SEQ_ERASED) log_seq = 0;
+}
+
+void
+session_log_task(void)
+{
+	if (pending_written >= sizeof(pending_record) || !eeprom_is_ready()) return;
+	eeprom_update_byte(SLOT_ADDR(pending_slot) + pending_written, ((uint8_t *)&pending_record)[pending_written]);
+	pending_written++;
+}
+
+void
+session_begin(void)
+{
+	if (session_active) session_end(SESSION_ABORTED);
+	memset(&cur_session, 0, sizeof(cur_session));
+	session_start = millis();
+	session_active = 1;
+}
+
+void
+session_end(uint8_t result)
+{
+	struct session_record old;
+	if (!session_active) return;
+	session_active = 0;
+	
+	//two sessions ending within one record's write time, finish the older one first
+	while (pending_written < sizeof(pending_record))
+		session_log_task();
+	
+	cur_session.seq = log_seq++;
+	if (log_seq == SEQ_ERASED) log_seq = 0;
+	cur_session.start = host_time(session_start);
+	cur_session.duration = millis() - session_start;
+	cur_session.box_type = box_type;
+	cur_session.result = result;
+	cur_session.crc = record_crc(&cur_session);
+	
+	if (!read_slot(log_next, &old)) log_count++;
+	pending_record = cur_session;
+	pending_slot = log_next;
+	pending_written = 0;
+	log_next = (log_next + 1) % SESSION_LOG_SLOTS;
+}
+
+void
+session_note_wall_error(ms_time_t dur)
+{
+	if (!session_active) return;
+	cur_session.wall_errors++;
+	cur_session.wall_error_time += dur;
+}
+
+void
+session_note_drop(void)
+{
+	if (!session_active) return;
+	cur_session.drops++;
+}
+
+void
+session_log_seek(uint8_t page)
+{
+	log_cursor = page;
+}
+
+/* fills buf with { count, page, records[SESSION_LOG_PAGE_RECORDS] } oldest first and advances to the next page */
+uint8_t
+session_log_page(uint8_t *buf)
+{
+	struct session_record r;
+	uint16_t skip = log_cursor * SESSION_LOG_PAGE_RECORDS;
+	struct report_session_log *rep = (struct report_session_log *)buf;
+	uint8_t *out = rep->records;
+	uint8_t n = 0;
+	
+	memset(rep, 0, sizeof(*rep));
+	rep->count[0] = log_count;
+	rep->page[0] = log_cursor;
+	//log_next is the oldest slot in ring order
+	for (uint8_t i = 0; i < SESSION_LOG_SLOTS && n < SESSION_LOG_PAGE_RECORDS; i++) {
+		if (!read_slot((log_next + i) % SESSION_LOG_SLOTS, &r)) continue;
+		if (skip) {
+			skip--;
+			continue;
+		}
+		uint16_to_wire(r.seq, out);
+		time_to_wire(r.start, out+2);
+		uint32_to_wire(r.duration, out+10);
+		uint32_to_wire(r.wall_error_time, out+14);
+		uint16_to_wire(r.wall_errors, out+18);
+		out[20] = r.drops;
+		out[21] = r.box_type;
+		out[22] = r.result;
+		out[23] = r.crc;
+		out += SESSION_RECORD_WIRE_SIZE;
+		n++;
+	}
+	//stops one past the last page, so reading on keeps returning empty pages instead of wrapping round
+	if (log_cursor <= SESSION_LOG_SLOTS / SESSION_LOG_PAGE_RECORDS)
+		log_cursor++;
+	return sizeof(*rep);
+}
+
+void
+session_log_erase(void)
+{
+	struct session_record r;
+	while (pending_written < sizeof(pending_record))
+		session_log_task();
+	//breaking the crc is one byte of wear per record instead of the whole slot
+	for (uint8_t i = 0; i < SESSION_LOG_SLOTS; i++)
+		if (read_slot(i, &r))
+			eeprom_update_byte(SLOT_ADDR(i) + offsetof(struct session_record, crc), ~r.crc);
+	log_count = 0;
+	log_cursor = 0;
+}
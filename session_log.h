@@ -0,0 +1,38 @@
+#ifndef _SESSION_LOG_H_
+#define _SESSION_LOG_H_
+	#include <stdint.h>
+	#include "Timer.h"
+
+	/* one summary per task run, kept in an append-only ring at the top of the EEPROM so boxes can run without a host
+	 * and be read out later. crc is last so a record only becomes valid once its final byte is written. */
+	struct session_record {
+		uint16_t seq;
+		TIME_t start;
+		ms_time_t duration;
+		ms_time_t wall_error_time;
+		uint16_t wall_errors;
+		uint8_t drops;
+		uint8_t box_type;
+		uint8_t result;
+		uint8_t crc;
+	};
+	#define SESSION_RECORD_WIRE_SIZE (2+8+4+4+2+1+1+1+1)
+
+	#define SESSION_COMPLETED 1
+	#define SESSION_TIMED_OUT 2
+	#define SESSION_ABORTED 3
+
+	#define SESSION_LOG_ERASE 0xff
+
+	void session_log_init(void);
+	void session_log_task(void);
+
+	void session_begin(void);
+	void session_end(uint8_t result);
+	void session_note_wall_error(ms_time_t dur);
+	void session_note_drop(void);
+
+	void session_log_seek(uint8_t page);
+	uint8_t session_log_page(uint8_t *buf);
+	void session_log_erase(void);
+#endif
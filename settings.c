@@ -0,0 +1,144 @@
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "Config/AppConfig.h"
+#include "Timer.h"
+#include "settings.h"
+
+/* The store is a ring of SETTINGS_SLOTS slots. Each save writes the whole cache as key/length/value entries to the
+ * slot after the current one with the generation bumped, so wear is spread across the ring and the previous slot is
+ * still there if power goes mid-write. Loading takes the newest slot whose crc checks out. */
+#define SETTINGS_MAGIC 0x4f
+#define SETTINGS_VERSION 1
+#define SLOT_ADDR(i) ((uint8_t *)(SETTINGS_EEP_START + (i) * SETTINGS_SLOT_SIZE))
+
+struct settings_header {
+	uint8_t magic;
+	uint8_t version;
+	uint16_t generation;
+	uint8_t length; // bytes of entries following the header, the crc16 comes after them
+};
+
+struct settings_key {
+	uint8_t key;
+	uint8_t offset;
+	uint8_t size;
+};
+
+#define AS_SETTINGS_KEY(k, member) {.key = k, .offset = offsetof(struct settings, member), .size = sizeof(((struct settings *)0)->member)},
+const struct settings_key settings_keys[] PROGMEM = {SETTINGS_TABLE(AS_SETTINGS_KEY)};
+#define SETTINGS_KEY_COUNT (sizeof(settings_keys) / sizeof(settings_keys[0]))
+
+#define AS_ENTRY_SIZE(k, member) + 2 + sizeof(((struct settings *)0)->member)
+_Static_assert(sizeof(struct settings_header) SETTINGS_TABLE(AS_ENTRY_SIZE) + 2 <= SETTINGS_SLOT_SIZE,
+	"settings do not fit in an eeprom slot");
+_Static_assert(SETTINGS_EEP_START + SETTINGS_SLOTS * SETTINGS_SLOT_SIZE <= SESSION_LOG_EEP_START,
+	"settings store overlaps the session log");
+
+#define PEGGY_THRESHOLD 512
+#define TOOL_THRESHOLD_LO 480
+#define TOOL_THRESHOLD_HI 544
+struct settings settings = {
+	.peg_thresh = {[0 ... PEG_COUNT-1] = PEGGY_THRESHOLD},
+	.tool_thresh = {[0 ... TOOL_LINE_COUNT-1] = {TOOL_THRESHOLD_LO, TOOL_THRESHOLD_HI}},
+};
+uint8_t settings_slot;
+uint16_t settings_generation;
+
+static uint16_t
+slot_crc(const uint8_t *buf, uint8_t len)
+{
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 0; i < len; i++)
+		crc = _crc16_update(crc, buf[i]);
+	return crc;
+}
+
+static uint8_t
+read_slot(uint8_t slot, uint8_t *buf)
+{
+	struct settings_header *h = (struct settings_header *)buf;
+	eeprom_read_block(buf, SLOT_ADDR(slot), SETTINGS_SLOT_SIZE);
+	if (h->magic != SETTINGS_MAGIC || h->version != SETTINGS_VERSION
+			|| h->length > SETTINGS_SLOT_SIZE - sizeof(*h) - 2)
+		return 0;
+	uint8_t len = sizeof(*h) + h->length;
+	return slot_crc(buf, len) == (buf[len] | (buf[len+1] << 8));
+}
+
+static void
+migrate_legacy(void)
+{
+	//before the store, box type sat at 13 and the thresholds at 0-11
+	uint8_t v = eeprom_read_byte((uint8_t *)13);
+	if (v != 0xff) settings.box_type = v;
+	for (int i = 0; i < PEG_COUNT; i++) {
+		uint16_t t = eeprom_read_word((uint16_t *)0 + i);
+		if (t != 0xffff) settings.peg_thresh[i] = t;
+	}
+}
+
+void
+settings_load(void)
+{
+	uint8_t buf[SETTINGS_SLOT_SIZE];
+	struct settings_header *h = (struct settings_header *)buf;
+	uint8_t found = 0;
+	
+	for (uint8_t i = 0; i < SETTINGS_SLOTS; i++) {
+		if (!read_slot(i, buf)) continue;
+		if (!found || (int16_t)(h->generation - settings_generation) > 0) {
+			settings_generation = h->generation;
+			settings_slot = i;
+			found = 1;
+		}
+	}
+	if (!found) {
+		migrate_legacy();
+		//slot 0 holds the legacy cells, so the first save goes to slot 1 and leaves them intact until it is done
+		settings_slot = 0;
+		settings_save();
+		return;
+	}
+	
+	read_slot(settings_slot, buf);
+	//unknown keys and keys whose size changed are skipped, missing ones keep their defaults
+	uint8_t *p = buf + sizeof(*h);
+	for (uint8_t i = 0; i + 2 <= h->length && i + 2 + p[i+1] <= h->length; i += 2 + p[i+1]) {
+		for (uint8_t k = 0; k < SETTINGS_KEY_COUNT; k++) {
+			if (pgm_read_byte(&settings_keys[k].key) != p[i]) continue;
+			if (pgm_read_byte(&settings_keys[k].size) == p[i+1])
+				memcpy((uint8_t *)&settings + pgm_read_byte(&settings_keys[k].offset), &p[i+2], p[i+1]);
+			break;
+		}
+	}
+}
+
+void
+settings_save(void)
+{
+	uint8_t buf[SETTINGS_SLOT_SIZE];
+	struct settings_header *h = (struct settings_header *)buf;
+	uint8_t *p = buf + sizeof(*h);
+	
+	for (uint8_t k = 0; k < SETTINGS_KEY_COUNT; k++) {
+		uint8_t size = pgm_read_byte(&settings_keys[k].size);
+		*p++ = pgm_read_byte(&settings_keys[k].key);
+		*p++ = size;
+		memcpy(p, (uint8_t *)&settings + pgm_read_byte(&settings_keys[k].offset), size);
+		p += size;
+	}
+	h->magic = SETTINGS_MAGIC;
+	h->version = SETTINGS_VERSION;
+	h->generation = ++settings_generation;
+	h->length = p - buf - sizeof(*h);
+	uint16_t crc = slot_crc(buf, p - buf);
+	*p++ = crc & 0xff;
+	*p++ = crc >> 8;
+	
+	settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+	eeprom_update_block(buf, SLOT_ADDR(settings_slot), p - buf);
+}
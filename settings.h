@@ -0,0 +1,37 @@
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+	#include <stdint.h>
+	#include "Config/AppConfig.h"
+	#include "Timer.h"
+	#include "peggy.h"
+
+	/* Every persistent setting lives here. The store is loaded into this RAM copy once at startup; code reads the
+	 * fields directly and calls settings_save() after changing them, nothing else touches the eeprom for settings. */
+	// hysteresis band of one tool line: it reads high once above hi and low once below lo, in between it stays put
+	struct tool_thresh {
+		uint16_t lo;
+		uint16_t hi;
+	};
+	#define TOOL_LINE_COUNT 3 // TOOL_LINES in box.h
+	#define TOOL_THRESH_MAX 1023 // the adc range
+	#define TOOL_THRESH_MIN_WIDTH 8
+
+	struct settings {
+		uint8_t box_type;
+		uint16_t peg_thresh[PEG_COUNT];
+		char serial[SERIAL_NUMBER_MAX_LEN]; // ascii, NUL padded, empty until provisioned
+		struct tool_thresh tool_thresh[TOOL_LINE_COUNT];
+	};
+
+	//keys are written to the eeprom, never renumber or reuse one
+	#define SETTINGS_TABLE(_) \
+		_(1, box_type) \
+		_(2, peg_thresh) \
+		_(3, serial) \
+		_(4, tool_thresh)
+
+	struct settings settings;
+
+	void settings_load(void);
+	void settings_save(void);
+#endif
@@ -0,0 +1,139 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "Timer.h"
+#include "led.h"
+#include "box.h"
+#include "sound.h"
+
+struct sound_step {
+	uint8_t cs; // Timer4 clock select, the prescaler is 1<<(cs-1)
+	uint8_t top;
+	uint8_t duty;
+	uint8_t hold;
+	uint16_t dur; // ms, 0 ends the cue
+};
+
+/* Timer4 runs 8 bit here, so pick the smallest prescaler that gets the period into 256 counts. Volume is 0..8 of a
+ * square wave, 8 being 50% duty, which is as loud as the buzzer goes. */
+#define TONE_FITS(hz, cs) (F_CPU / (1UL << ((cs)-1)) / (hz) <= 256)
+#define TONE_CS(hz) (TONE_FITS(hz, 5) ? 5 : TONE_FITS(hz, 6) ? 6 : TONE_FITS(hz, 7) ? 7 : TONE_FITS(hz, 8) ? 8 : 9)
+#define TONE_TOP(hz) (F_CPU / (1UL << (TONE_CS(hz)-1)) / (hz) - 1)
+#define TONE(hz, vol, ms) {TONE_CS(hz), TONE_TOP(hz), TONE_TOP(hz) * (vol) / 16, 0, ms}
+#define HOLD(hz, vol, ms) {TONE_CS(hz), TONE_TOP(hz), TONE_TOP(hz) * (vol) / 16, 1, ms}
+#define REST(ms) {TONE_CS(2000), TONE_TOP(2000), 0, 0, ms}
+#define END {0, 0, 0, 0, 0}
+
+static const struct sound_step cue_wall_error[] PROGMEM = {
+	HOLD(2000, 8, MIN_BUZZER_LENGTH),
+	END
+};
+static const struct sound_step cue_drop[] PROGMEM = {
+	HOLD(1000, 8, MIN_BUZZER_LENGTH),
+	END
+};
+static const struct sound_step cue_stage_success[] PROGMEM = {
+	TONE(1568, 6, 80), TONE(1976, 6, 80), TONE(2349, 6, 80), TONE(3136, 8, 200),
+	END
+};
+static const struct sound_step cue_timeout[] PROGMEM = {
+	TONE(1500, 8, 300), REST(100), TONE(1000, 8, 600),
+	END
+};
+
+static const struct sound_step cue_cal_step[] PROGMEM = {
+	TONE(2637, 6, 60),
+	END
+};
+static const struct sound_step cue_cal_done[] PROGMEM = {
+	TONE(1568, 6, 120), TONE(2093, 6, 120), TONE(2637, 8, 300),
+	END
+};
+static const struct sound_step cue_cal_fail[] PROGMEM = {
+	TONE(500, 8, 200), REST(100), TONE(500, 8, 200), REST(100), TONE(400, 8, 500),
+	END
+};
+
+#define AS_CUE_PTR(name) cue_##name,
+static const struct sound_step *const cues[SOUND_COUNT] PROGMEM = {SOUND_CUES(AS_CUE_PTR)};
+
+static const struct sound_step *volatile sound_cur;
+static volatile uint16_t sound_left;
+static volatile uint8_t sound_released;
+
+static void
+sound_silence(void)
+{
+	OCR4B = 0;
+	sound_cur = NULL;
+}
+
+static void
+sound_load(const struct sound_step *s)
+{
+	uint16_t dur = pgm_read_word(&s->dur);
+
+	if (!dur) {
+		sound_silence();
+		return;
+	}
+	TCCR4B = (TCCR4B & ~0x0f) | pgm_read_byte(&s->cs);
+	OCR4C = pgm_read_byte(&s->top);
+	OCR4B = pgm_read_byte(&s->duty);
+	sound_left = dur;
+	sound_cur = s;
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+	const struct sound_step *s = sound_cur;
+
+	if (!s) return;
+	if (sound_left > 1) {
+		sound_left--;
+		return;
+	}
+	if (pgm_read_byte(&s->hold) && !sound_released) return;
+	sound_load(s + 1);
+}
+
+void
+sound_init(void)
+{
+	//set up timer and pwm
+	//page 164 and following
+	TCCR4A = (1<<PWM4B) | (1<<COM4B0);
+	TCCR4B = (1<<CS42)|(1<<CS41); /* set prescaler to 1/32 */
+	TCCR4D &= ~0x03;
+	OCR4B = 0;
+
+	//the step clock shares Timer0 with millis, compare B fires once per 1 ms CTC period
+	OCR0B = 124;
+	TIMSK0 |= (1<<OCIE0B);
+}
+
+/* Starts a cue, cutting off whatever was playing. */
+void
+sound_play(enum sound_cue cue)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sound_released = 0;
+		sound_load(pgm_read_ptr(&cues[cue]));
+	}
+}
+
+/* Lets a held step end, once its duration is up. */
+void
+sound_release(void)
+{
+	sound_released = 1;
+}
+
+void
+sound_stop(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sound_silence();
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef _SOUND_H_
+#define _SOUND_H_
+	#include <stdint.h>
+
+	/* Buzzer cues. Each is a list of steps in flash (see sound.c): a tone on Timer4 with a volume and a duration.
+	 *
+	 * Timer4 makes the tone, its prescaler and TOP (OCR4C) set the pitch and OCR4B the duty, which is the volume. The
+	 * steps are timed by a 1 ms interrupt on Timer0 compare B, so a cue plays the same whatever the main loop is doing.
+	 * A hold step keeps sounding after its duration until sound_release(), which is how a beep lasts as long as the
+	 * error causing it but never less than the step's duration.
+	 */
+	#define SOUND_CUES(_) \
+		_(wall_error) \
+		_(drop) \
+		_(stage_success) \
+		_(timeout) \
+		_(cal_step) \
+		_(cal_done) \
+		_(cal_fail)
+
+	#define AS_SOUND_ENUM(name) SOUND_##name,
+	enum sound_cue {
+		SOUND_CUES(AS_SOUND_ENUM)
+		SOUND_COUNT
+	};
+
+	void
+	sound_init(void);
+	void
+	sound_play(enum sound_cue cue);
+	void
+	sound_release(void);
+	void
+	sound_stop(void);
+#endif